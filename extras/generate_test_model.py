@@ -205,6 +205,75 @@ class AudioUtils(nn_tilde.Module):
         return 0
 
 
+class ConvEffect(nn_tilde.Module):
+    """Heavier fixture for the benchmarks, a stack of dilated convolutions."""
+
+    def __init__(self, channels: int = 32, layers: int = 6):
+        super().__init__()
+        convs = [nn.Conv1d(1, channels, 3, padding=1)]
+        for i in range(layers):
+            dilation = 2**i
+            convs.append(
+                nn.Conv1d(channels,
+                          channels,
+                          3,
+                          padding=dilation,
+                          dilation=dilation))
+        self.convs = nn.ModuleList(convs)
+        self.out = nn.Conv1d(channels, 1, 1)
+
+        self.register_method(
+            'forward',
+            in_channels=1,
+            in_ratio=1,
+            out_channels=1,
+            out_ratio=1,
+            input_labels=['(signal) input signal'],
+            output_labels=['(signal) output signal'],
+        )
+
+    def forward(self, x: torch.Tensor):
+        for conv in self.convs:
+            x = torch.tanh(conv(x))
+        return self.out(x)
+
+
+class GRUEncoder(nn_tilde.Module):
+    """Heavier fixture for the benchmarks, a recurrent encoder of frames."""
+
+    def __init__(self, frame_size: int = 256, hidden: int = 128,
+                 latents: int = 8):
+        super().__init__()
+        self.frame_size = frame_size
+        self.gru = nn.GRU(frame_size, hidden, num_layers=2, batch_first=True)
+        self.project = nn.Linear(hidden, latents)
+
+        self.register_method(
+            'forward',
+            in_channels=1,
+            in_ratio=1,
+            out_channels=latents,
+            out_ratio=frame_size,
+            input_labels=['(signal) input signal'],
+            output_labels=[f'(signal) latent {i}' for i in range(latents)],
+        )
+
+    def forward(self, x: torch.Tensor):
+        # NO STATE IS KEPT ACROSS CALLS, SO THAT OUTPUTS ARE REPRODUCIBLE
+        frames = x.reshape(x.shape[0], -1, self.frame_size)
+        z, _ = self.gru(frames)
+        return self.project(z).transpose(1, 2)
+
+
 if __name__ == '__main__':
+    import sys
+    output_dir = sys.argv[1] if len(sys.argv) > 1 else '.'
+
     model = AudioUtils()
-    model.export_to_ts('multieffect.ts')
+    model.export_to_ts(f'{output_dir}/multieffect.ts')
+
+    # FIXED SEEDS, SO THAT THE GOLDENS OF nn_suite STAY VALID
+    torch.manual_seed(0)
+    ConvEffect().export_to_ts(f'{output_dir}/conv.ts')
+    torch.manual_seed(1)
+    GRUEncoder().export_to_ts(f'{output_dir}/gru.ts')
@@ -1,115 +1,340 @@
 #include "backend.h"
+#include "batch_scheduler.h"
+#include "device_placement.h"
+#include "dsp_utils.h"
+#include "model_cache.h"
+#include "model_registry.h"
 #include "parsing_utils.h"
+#include <ATen/Parallel.h>
 #include <algorithm>
+#include <c10/core/StreamGuard.h>
+#include <c10/core/impl/DeviceGuardImplInterface.h>
 #include <iostream>
+#include <torch/csrc/jit/runtime/graph_executor.h>
 #include <stdlib.h>
 
 #define CPU torch::kCPU
 #define CUDA torch::kCUDA
 #define MPS torch::kMPS
 
-Backend::Backend() : m_loaded(0), m_device(CPU), m_use_gpu(false) {
+// INTRA-OP THREADS USED BY INSTANCES WITHOUT A BUDGET OF THEIR OWN
+static std::atomic<int> global_intra_op_threads{0};
+
+// WITH OPENMP, THE NUMBER OF INTRA-OP THREADS IS A SETTING OF THE CALLING
+// THREAD. COMPUTE WORKERS ARE SHARED BY EVERY INSTANCE, SO THAT THE BUDGET OF
+// AN INSTANCE IS SET RIGHT BEFORE ITS FORWARD PASS (A NO-OP IF UNCHANGED)
+static void use_intra_op_budget(int n_threads) {
+#if AT_PARALLEL_OPENMP
+  int budget = global_intra_op_threads;
+  if (n_threads > 0)
+    budget = budget > 0 ? std::min(n_threads, budget) : n_threads;
+  if (budget > 0 && at::get_num_threads() != budget)
+    at::set_num_threads(budget);
+#endif
+}
+
+Backend::Backend()
+    : m_loaded(0), m_device(CPU), m_device_name("cpu"),
+      m_optimization_level(OPTIMIZE_NONE), m_precision(PRECISION_FP32),
+      m_effective_precision(PRECISION_FP32), m_warmup_iterations(0),
+      m_warmup_n_vec(0), m_warmup_n_batches(1) {
   at::init_num_threads();
+  int default_threads = 0;
+  global_intra_op_threads.compare_exchange_strong(default_threads,
+                                                  at::get_num_threads());
 }
 
 void Backend::perform(std::vector<float *> in_buffer,
                       std::vector<float *> out_buffer, int n_vec,
                       std::string method, int n_batches) {
-  c10::InferenceMode guard;
+  auto method_id = get_method_id(method);
+
+  if (method_id < 0 || !m_loaded)
+    return;
 
-  auto params = get_method_params(method);
-  // std::cout << "in_buffer length : " << in_buffer.size() << std::endl;
-  // std::cout << "out_buffer length : " << out_buffer.size() << std::endl;
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  auto in_dim = m_methods[method_id].in_dim;
+  model_lock.unlock();
+
+  if (in_dim * n_batches != in_buffer.size()) {
+    std::cout << "bad in_buffer size, expected " << in_dim * n_batches
+              << " buffers, got " << in_buffer.size() << "!\n";
+    return;
+  }
 
-  if (!params.size())
+  if (prepare(method_id, n_vec, n_batches))
     return;
 
-  auto in_dim = params[0];
-  auto in_ratio = params[1];
-  auto out_dim = params[2];
-  auto out_ratio = params[3];
+  // CHANNEL MAJOR BUFFERS, DECIMATED INTO THE BATCH MAJOR TENSOR
+  std::vector<float *> batch_major(in_buffer.size());
+  for (int d(0); d < in_dim; d++)
+    for (int b(0); b < n_batches; b++)
+      batch_major[b * in_dim + d] = in_buffer[d * n_batches + b];
+
+  perform_method(batch_major, out_buffer, n_vec, method_id, n_batches, true);
+}
+
+int Backend::prepare(int method_id, int n_vec, int n_batches) {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  if (method_id < 0 || method_id >= m_methods.size() ||
+      m_methods[method_id].steps.empty())
+    return 1;
+
+  auto &descriptor = m_methods[method_id];
+  auto &prepared = descriptor.buffers;
+  if (prepared.input.defined() && prepared.n_vec == n_vec &&
+      prepared.n_batches == n_batches &&
+      prepared.input.size(1) == descriptor.in_dim &&
+      prepared.output.size(1) == descriptor.out_dim)
+    return 0;
+
+  // PINNED MEMORY ALLOWS ASYNCHRONOUS TRANSFERS BETWEEN HOST AND DEVICE
+  auto options = torch::TensorOptions()
+                     .dtype(torch::kFloat32)
+                     .pinned_memory(m_device.is_cuda());
+  prepared.input = torch::zeros(
+      {n_batches, descriptor.in_dim, n_vec / descriptor.in_ratio}, options);
+  prepared.output = torch::zeros(
+      {n_batches, descriptor.out_dim, n_vec / descriptor.out_ratio}, options);
+  prepared.history = torch::zeros({n_batches * descriptor.out_dim});
+  prepared.n_vec = n_vec;
+  prepared.n_batches = n_batches;
+  auto key = m_engine->get_batching_key();
+  prepared.batch_member = nullptr; // GIVES ITS SLOT BACK FIRST
+  prepared.batch_member =
+      m_use_batching && key && descriptor.steps.size() == 1
+          ? BatchScheduler::get().join(key, descriptor.name, n_vec, n_batches)
+          : nullptr;
+  return 0;
+}
+
+void Backend::perform_prepared(const std::vector<float *> &in_buffer,
+                               const std::vector<float *> &out_buffer,
+                               int n_vec, int method_id, int n_batches) {
+  perform_method(in_buffer, out_buffer, n_vec, method_id, n_batches, false);
+}
+
+void Backend::perform_method(const std::vector<float *> &in_buffer,
+                             const std::vector<float *> &out_buffer,
+                             int n_vec, int method_id, int n_batches,
+                             bool decimate) {
+  c10::InferenceMode guard;
 
   if (!m_loaded)
     return;
 
-  // COPY BUFFER INTO A TENSOR
-  std::vector<at::Tensor> tensor_in;
-  // for (auto buf : in_buffer)
-  for (int i(0); i < in_buffer.size(); i++) {
-    tensor_in.push_back(torch::from_blob(in_buffer[i], {1, 1, n_vec}));
-    // std::cout << i << " : " << tensor_in[i].min().item<float>() << std::endl;
-  }
-
-  auto cat_tensor_in = torch::cat(tensor_in, 1);
-  cat_tensor_in = cat_tensor_in.reshape({in_dim, n_batches, -1, in_ratio});
-  cat_tensor_in = cat_tensor_in.select(-1, -1);
-  cat_tensor_in = cat_tensor_in.permute({1, 0, 2});
-  // std::cout << cat_tensor_in.size(0) << ";" << cat_tensor_in.size(1) << ";" << cat_tensor_in.size(2) << std::endl;
-  // for (int i = 0; i < cat_tensor_in.size(1); i++ ) 
-    // std::cout << cat_tensor_in[0][i][0] << ";";
-  // std::cout << std::endl;
+  StageTimer total_timer(m_stats);
 
-  // SEND TENSOR TO DEVICE
   std::unique_lock<std::mutex> model_lock(m_model_mutex);
-  cat_tensor_in = cat_tensor_in.to(m_device);
-  std::vector<torch::jit::IValue> inputs = {cat_tensor_in};
+  if (method_id < 0 || method_id >= m_methods.size() ||
+      m_methods[method_id].steps.empty())
+    return;
 
-  // PROCESS TENSOR
-  at::Tensor tensor_out;
-  try {
-    tensor_out = m_model.get_method(method)(inputs).toTensor();
-    tensor_out = tensor_out.repeat_interleave(out_ratio).reshape(
-        {n_batches, out_dim, -1});
-  } catch (const std::exception &e) {
-    std::cerr << e.what() << '\n';
+  auto &descriptor = m_methods[method_id];
+  auto out_dim = descriptor.out_dim;
+  auto out_ratio = descriptor.out_ratio;
+  // REFERENCES, SO THAT A CONCURRENT prepare OR RELOAD CANNOT FREE THEM WHILE
+  // THE OUTPUT IS EXPANDED WITHOUT THE LOCK
+  auto host_output = descriptor.buffers.output;
+  auto history = descriptor.buffers.history;
+  auto stream = m_stream;
+  auto device = m_device;
+  bool auto_placed = bool(m_device_lease);
+
+  // SETTERS QUEUED BY THE MESSAGE THREAD ARE APPLIED BETWEEN TWO BUFFERS
+  run_attribute_commands();
+  use_intra_op_budget(m_intra_op_threads);
+  StageTimer stage_timer(m_stats);
+
+  if (descriptor.buffers.n_vec != n_vec || n_batches <= 0 ||
+      n_batches > descriptor.buffers.n_batches) {
+    std::cout << "input of method " << descriptor.name
+              << " is not prepared for " << n_batches << " batches of "
+              << n_vec << " samples!\n";
     return;
   }
-  model_lock.unlock();
 
-  int out_batches(tensor_out.size(0)), out_channels(tensor_out.size(1)),
-      out_n_vec(tensor_out.size(2));
+  // THE INPUT TENSOR IS ONLY ACCESSED UNDER THE MODEL LOCK, prepare MAY
+  // REALLOCATE IT
+  if (in_buffer.size() != n_batches * descriptor.in_dim) {
+    std::cout << "bad in_buffer size, expected "
+              << n_batches * descriptor.in_dim << " buffers, got "
+              << in_buffer.size() << "!\n";
+    return;
+  }
+  auto n_frames = descriptor.buffers.input.size(2);
+  auto input_ptr = descriptor.buffers.input.data_ptr<float>();
+  for (int c(0); c < in_buffer.size(); c++) {
+    auto tensor_ptr = input_ptr + c * n_frames;
+    if (!decimate)
+      std::copy_n(in_buffer[c], n_frames, tensor_ptr);
+    else if (m_input_averaging)
+      decimate_mean(in_buffer[c], tensor_ptr, n_frames, descriptor.in_ratio);
+    else
+      decimate_last(in_buffer[c], tensor_ptr, n_frames, descriptor.in_ratio);
+  }
 
-  // for (int b(0); b < out_batches; b++) {
-  //   for (int c(0); c < out_channels; c++) {
-  //     std::cout << b << ";" << c << ";" << tensor_out[b][c].min().item<float>() << std::endl;
-  //   }
-  // }
+  // BUFFERS ARE PREPARED FOR THE LARGEST BATCH, A SMALLER ONE ONLY USES A VIEW
+  // ON THEIR FIRST VOICES
+  auto tensor_in = descriptor.buffers.input.narrow(0, 0, n_batches);
+  host_output = host_output.narrow(0, 0, n_batches);
+
+  // EVERYTHING BELOW IS QUEUED ON THE STREAM OF THIS INSTANCE, THE HOST ONLY
+  // WAITS FOR THE DEVICE ONCE THE RESULT IS NEEDED
+  c10::OptionalStreamGuard stream_guard(stream);
+
+  // SEND TENSOR TO DEVICE, ASYNCHRONOUSLY FROM THE PINNED INPUT, AND CAST IT
+  // TO THE PRECISION OF THE MODEL
+  auto dtype = precision_dtype(m_effective_precision);
+  if (!m_device.is_cpu() || dtype != torch::kFloat32) {
+    auto &device_input = descriptor.buffers.device_input;
+    auto sizes = descriptor.buffers.input.sizes();
+    if (!device_input.defined() || device_input.device() != m_device ||
+        device_input.scalar_type() != dtype || device_input.sizes() != sizes)
+      device_input = torch::empty(
+          sizes, torch::TensorOptions().dtype(dtype).device(m_device));
+    auto device_view = device_input.narrow(0, 0, n_batches);
+    device_view.copy_(tensor_in, true);
+    tensor_in = device_view;
+  }
+  stage_timer.lap(STAGE_INPUT);
+
+  at::Tensor tensor_out;
+  if (descriptor.buffers.batch_member) {
+    // GATHER WITH THE OTHER INSTANCES, WITHOUT HOLDING THE MODEL LOCK
+    auto batch_member = descriptor.buffers.batch_member;
+    auto engine = m_engine;
+    auto method = descriptor.steps[0];
+    model_lock.unlock();
+    // THE GROUP LEADER READS OUR INPUT FROM ITS OWN STREAM
+    if (stream)
+      stream->synchronize();
+    tensor_out = batch_member->run(*engine, method, tensor_in);
+    if (!tensor_out.defined())
+      return;
+  } else {
+    // PROCESS TENSOR, CHAINED METHODS ARE FED WITH THE PREVIOUS OUTPUT, ON
+    // THE DEVICE
+    try {
+      tensor_out = tensor_in;
+      for (auto method : descriptor.steps)
+        tensor_out = m_engine->run(method, tensor_out);
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << '\n';
+      return;
+    }
+    model_lock.unlock();
+  }
+  // ON GPU, THE FORWARD STAGE ONLY QUEUES THE KERNELS, THE OUTPUT STAGE WAITS
+  // FOR THEIR COMPLETION
+  auto call_time = stage_timer.lap(STAGE_FORWARD);
 
   // CHECKS ON TENSOR SHAPE
-  if (out_batches * out_channels != out_buffer.size()) {
-    std::cout << "bad out_buffer size, expected " << out_batches * out_channels
+  if (tensor_out.dim() != 3 || tensor_out.size(0) != n_batches ||
+      tensor_out.size(1) != out_dim ||
+      n_batches * out_dim != out_buffer.size()) {
+    std::cout << "bad out_buffer size, expected " << n_batches * out_dim
               << " buffers, got " << out_buffer.size() << "!\n";
     return;
   }
 
-  if (out_n_vec != n_vec) {
+  if (tensor_out.size(2) * out_ratio != n_vec) {
     std::cout << "model output size is not consistent, expected " << n_vec
-              << " samples, got " << out_n_vec << "!\n";
+              << " samples, got " << tensor_out.size(2) * out_ratio << "!\n";
     return;
   }
 
-  tensor_out = tensor_out.to(CPU);
-  tensor_out = tensor_out.reshape({out_batches * out_channels, -1});
-  auto out_ptr = tensor_out.contiguous().data_ptr<float>();
+  // BRING THE RAW MODEL OUTPUT BACK TO HOST MEMORY (AND TO FLOAT32), WITHOUT
+  // UPSAMPLING IT
+  if (tensor_out.device().type() != CPU ||
+      tensor_out.scalar_type() != torch::kFloat32 ||
+      !tensor_out.is_contiguous()) {
+    host_output.copy_(tensor_out, stream.has_value());
+    if (stream)
+      stream->synchronize();
+    tensor_out = host_output;
+  }
 
+  // EXPAND EACH CHANNEL DIRECTLY INTO THE FRONTEND BUFFERS
+  auto out_ptr = tensor_out.data_ptr<float>();
+  auto history_ptr = history.data_ptr<float>();
+  auto n_frames = tensor_out.size(2);
   for (int i(0); i < out_buffer.size(); i++) {
-    memcpy(out_buffer[i], out_ptr + i * n_vec, n_vec * sizeof(float));
+    if (m_linear_interpolation)
+      expand_linear(out_ptr + i * n_frames, out_buffer[i], n_frames, out_ratio,
+                    history_ptr[i]);
+    else
+      expand_hold(out_ptr + i * n_frames, out_buffer[i], n_frames, out_ratio);
   }
+  call_time += stage_timer.lap(STAGE_OUTPUT);
+  // THE AUTOMATIC PLACEMENT BALANCES THE DEVICES ON THE MEASURED LATENCIES
+  if (auto_placed)
+    DevicePlacement::get().record_latency(device, call_time);
+  total_timer.lap(STAGE_TOTAL);
 }
 
-int Backend::load(std::string path) {
-  try {
-    auto model = torch::jit::load(path);
-    model.eval();
-    model.to(m_device);
+static std::shared_ptr<const AttributeValues>
+read_attribute_values(Engine &engine, const ModelMetadata &metadata) {
+  auto values = std::make_shared<AttributeValues>();
+  for (const auto &attribute : metadata.settable_attributes) {
+    try {
+      (*values)[attribute] = engine.get_attribute(attribute);
+    } catch (...) {
+    }
+  }
+  return values;
+}
 
+int Backend::load(std::string path) { return load_model(path, false); }
+
+int Backend::load_model(std::string path, bool force_reload) {
+  try {
     std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    m_model = model;
-    m_loaded = 1;
+    auto settings = get_engine_settings();
+    settings.force_reload = force_reload;
+    // AN AUTOMATICALLY PLACED INSTANCE KEEPS ITS DEVICE WHEN RELOADING
+    std::shared_ptr<DeviceLease> lease;
+    if (m_device_name == "auto") {
+      lease = m_device_lease;
+      if (!lease || lease->path != path)
+        lease = DevicePlacement::get().acquire(path, m_use_batching);
+      settings.device = lease->device;
+    }
+    auto engine_name = m_engine_name;
+    auto warmup_iterations = m_warmup_iterations;
+    auto warmup_n_vec = m_warmup_n_vec;
+    auto warmup_n_batches = m_warmup_n_batches;
     model_lock.unlock();
 
-    m_available_methods = get_available_methods();
+    std::shared_ptr<Engine> engine = create_engine(engine_name, path);
+    if (!engine)
+      throw std::runtime_error("unknown engine " + engine_name);
+    engine->load(path, settings);
+
+    // THE FIRST (SLOW) CALLS HAPPEN BEFORE THE MODEL IS SWAPPED IN
+    if (warmup_iterations > 0 && warmup_n_vec > 0)
+      engine->warm_up(warmup_iterations, warmup_n_vec, warmup_n_batches);
+
+    // METADATA IS READ ONCE, BEFORE THE MODEL IS VISIBLE TO THE OTHER THREADS
+    auto metadata = engine->get_metadata();
+    auto values = read_attribute_values(*engine, *metadata);
+
+    // SWAP THE MODEL BETWEEN TWO BUFFERS, A COMPUTATION IN FLIGHT FINISHES
+    // WITH THE PREVIOUS ENGINE
+    model_lock.lock();
+    m_engine = engine;
     m_path = path;
+    m_device = settings.device;
+    m_device_lease = lease;
+    update_stream();
+    m_effective_precision = engine->get_precision();
+    std::atomic_store(&m_metadata, metadata);
+    std::atomic_store(&m_attribute_values, values);
+    m_loaded = 1;
+    resolve_method_descriptors();
+    model_lock.unlock();
+
+    update_batch_groups();
     return 0;
   } catch (const std::exception &e) {
     std::cerr << e.what() << '\n';
@@ -118,135 +343,94 @@ int Backend::load(std::string path) {
 }
 
 int Backend::reload() {
-  auto return_code = load(m_path);
+  auto return_code = load_model(m_path, true);
   return return_code;
 }
 
-bool Backend::has_method(std::string method_name) {
-  std::unique_lock<std::mutex> model_lock(m_model_mutex);
-  for (const auto &m : m_model.get_methods()) {
-    if (m.name() == method_name)
-      return true;
+int Backend::load_model_async(std::string path, bool force_reload,
+                              std::function<void(int)> callback) {
+  if (m_loading.exchange(true)) {
+    std::cerr << "a model is already being loaded" << std::endl;
+    return 1;
   }
-  return false;
+  if (m_load_future.valid())
+    m_load_future.wait();
+  m_load_future =
+      std::async(std::launch::async, [this, path, force_reload, callback] {
+        auto return_code = load_model(path, force_reload);
+        m_loading = false;
+        if (callback)
+          callback(return_code);
+      });
+  return 0;
 }
 
-bool Backend::has_settable_attribute(std::string attribute) {
-  for (const auto &a : get_settable_attributes()) {
-    if (a == attribute)
-      return true;
-  }
-  return false;
+int Backend::load_async(std::string path, std::function<void(int)> callback) {
+  return load_model_async(path, false, callback);
 }
 
-std::vector<std::string> Backend::get_available_methods() {
-  std::vector<std::string> methods;
-  try {
-    std::vector<c10::IValue> dumb_input = {};
+int Backend::reload_async(std::function<void(int)> callback) {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  auto path = m_path;
+  model_lock.unlock();
+  return load_model_async(path, true, callback);
+}
 
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    auto methods_from_model =
-        m_model.get_method("get_methods")(dumb_input).toList();
-    model_lock.unlock();
+bool Backend::is_loading() { return m_loading; }
 
-    for (int i = 0; i < methods_from_model.size(); i++) {
-      methods.push_back(methods_from_model.get(i).toStringRef());
-    }
-  } catch (...) {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    for (const auto &m : m_model.get_methods()) {
-      try {
-        auto method_params = m_model.attr(m.name() + "_params");
-        methods.push_back(m.name());
-      } catch (...) {
-      }
-    }
-    model_lock.unlock();
-  }
-  return methods;
+void Backend::wait_for_load() {
+  if (m_load_future.valid())
+    m_load_future.wait();
+}
+
+std::shared_ptr<const ModelMetadata> Backend::get_metadata() {
+  auto metadata = std::atomic_load(&m_metadata);
+  if (!metadata)
+    metadata = std::make_shared<const ModelMetadata>();
+  return metadata;
+}
+
+bool Backend::has_method(std::string method_name) {
+  auto metadata = get_metadata();
+  return std::count(metadata->methods.begin(), metadata->methods.end(),
+                    method_name);
+}
+
+bool Backend::has_settable_attribute(std::string attribute) {
+  auto metadata = get_metadata();
+  return std::count(metadata->settable_attributes.begin(),
+                    metadata->settable_attributes.end(), attribute);
+}
+
+std::vector<std::string> Backend::get_available_methods() {
+  return get_metadata()->available_methods;
 }
 
 std::vector<std::string> Backend::get_available_attributes() {
-  std::vector<std::string> attributes;
-  std::unique_lock<std::mutex> model_lock(m_model_mutex);
-  for (const auto &attribute : m_model.named_attributes())
-    attributes.push_back(attribute.name);
-  return attributes;
+  return get_metadata()->attributes;
 }
 
 std::vector<std::string> Backend::get_settable_attributes() {
-  std::vector<std::string> attributes;
-  try {
-    std::vector<c10::IValue> dumb_input = {};
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    auto methods_from_model =
-        m_model.get_method("get_attributes")(dumb_input).toList();
-    model_lock.unlock();
-    for (int i = 0; i < methods_from_model.size(); i++) {
-      attributes.push_back(methods_from_model.get(i).toStringRef());
-    }
-  } catch (...) {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    for (const auto &a : m_model.named_attributes()) {
-      try {
-        auto method_params = m_model.attr(a.name + "_params");
-        attributes.push_back(a.name);
-      } catch (...) {
-      }
-    }
-    model_lock.unlock();
-  }
-  return attributes;
+  return get_metadata()->settable_attributes;
 }
 
 std::vector<c10::IValue> Backend::get_attribute(std::string attribute_name) {
-  std::string attribute_getter_name = "get_" + attribute_name;
-  try {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    auto attribute_getter = m_model.get_method(attribute_getter_name);
-    model_lock.unlock();
-  } catch (...) {
+  auto values = std::atomic_load(&m_attribute_values);
+  if (!values || !values->count(attribute_name))
     throw "getter for attribute " + attribute_name + " not found in model";
-  }
-  std::vector<c10::IValue> getter_inputs = {}, attributes;
-  try {
-    try {
-      std::unique_lock<std::mutex> model_lock(m_model_mutex);
-      attributes = m_model.get_method(attribute_getter_name)(getter_inputs)
-                       .toList()
-                       .vec();
-      model_lock.unlock();
-    } catch (...) {
-      std::unique_lock<std::mutex> model_lock(m_model_mutex);
-      auto output_tuple =
-          m_model.get_method(attribute_getter_name)(getter_inputs).toTuple();
-      attributes = (*output_tuple.get()).elements();
-      model_lock.unlock();
-    }
-  } catch (...) {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    attributes.push_back(
-        m_model.get_method(attribute_getter_name)(getter_inputs));
-    model_lock.unlock();
-  }
-  return attributes;
+  return values->at(attribute_name);
 }
 
 std::string Backend::get_attribute_as_string(std::string attribute_name) {
   std::vector<c10::IValue> getter_outputs = get_attribute(attribute_name);
-  // finstringd arguments
-  torch::Tensor setter_params;
-  try {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    setter_params = m_model.attr(attribute_name + "_params").toTensor();
-    model_lock.unlock();
-  } catch (...) {
+  auto metadata = get_metadata();
+  if (!metadata->attribute_types.count(attribute_name))
     throw "parameters to set attribute " + attribute_name +
         " not found in model";
-  }
+  auto &setter_params = metadata->attribute_types.at(attribute_name);
   std::string current_attr = "";
-  for (int i = 0; i < setter_params.size(0); i++) {
-    int current_id = setter_params[i].item().toInt();
+  for (int i = 0; i < setter_params.size(); i++) {
+    int current_id = setter_params[i];
     switch (current_id) {
     // bool case
     case 0: {
@@ -275,7 +459,7 @@ std::string Backend::get_attribute_as_string(std::string attribute_name) {
       break;
     }
     }
-    if (i < setter_params.size(0) - 1)
+    if (i < setter_params.size() - 1)
       current_attr += " ";
   }
   return current_attr;
@@ -283,29 +467,24 @@ std::string Backend::get_attribute_as_string(std::string attribute_name) {
 
 void Backend::set_attribute(std::string attribute_name,
                             std::vector<std::string> attribute_args) {
+  auto metadata = get_metadata();
   // find setter
   std::string attribute_setter_name = "set_" + attribute_name;
-  try {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    auto attribute_setter = m_model.get_method(attribute_setter_name);
-    model_lock.unlock();
-  } catch (...) {
+  if (!std::count(metadata->methods.begin(), metadata->methods.end(),
+                  attribute_setter_name))
     throw "setter for attribute " + attribute_name + " not found in model";
-  }
   // find arguments
-  torch::Tensor setter_params;
-  try {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    setter_params = m_model.attr(attribute_name + "_params").toTensor();
-    model_lock.unlock();
-  } catch (...) {
+  if (!metadata->attribute_types.count(attribute_name))
     throw "parameters to set attribute " + attribute_name +
         " not found in model";
-  }
+  auto &setter_params = metadata->attribute_types.at(attribute_name);
+  if (attribute_args.size() < setter_params.size())
+    throw "attribute " + attribute_name + " expects " +
+        std::to_string(setter_params.size()) + " arguments";
   // process inputs
   std::vector<c10::IValue> setter_inputs = {};
-  for (int i = 0; i < setter_params.size(0); i++) {
-    int current_id = setter_params[i].item().toInt();
+  for (int i = 0; i < setter_params.size(); i++) {
+    int current_id = setter_params[i];
     switch (current_id) {
     // bool case
     case 0:
@@ -329,43 +508,243 @@ void Backend::set_attribute(std::string attribute_name,
       break;
     }
   }
-  try {
-    std::unique_lock<std::mutex> model_lock(m_model_mutex);
-    auto setter_out = m_model.get_method(attribute_setter_name)(setter_inputs);
-    model_lock.unlock();
-    int setter_result = setter_out.toInt();
-    if (setter_result != 0) {
-      throw "setter returned -1";
+  set_attribute(attribute_name, setter_inputs);
+}
+
+void Backend::set_attribute(std::string attribute_name,
+                            std::vector<c10::IValue> setter_inputs) {
+  auto metadata = get_metadata();
+  // find setter
+  std::string attribute_setter_name = "set_" + attribute_name;
+  if (!std::count(metadata->methods.begin(), metadata->methods.end(),
+                  attribute_setter_name))
+    throw "setter for attribute " + attribute_name + " not found in model";
+  if (!metadata->attribute_types.count(attribute_name))
+    throw "parameters to set attribute " + attribute_name +
+        " not found in model";
+  auto n_params = metadata->attribute_types.at(attribute_name).size();
+  if (setter_inputs.size() < n_params)
+    throw "attribute " + attribute_name + " expects " +
+        std::to_string(n_params) + " arguments";
+  setter_inputs.resize(n_params);
+
+  // THE SETTER IS CALLED BY THE COMPUTE THREAD, BETWEEN TWO BUFFERS. A
+  // PENDING CALL TO THE SAME SETTER IS REPLACED, ONLY THE LATEST VALUE COUNTS
+  std::unique_lock<std::mutex> command_lock(m_command_mutex);
+  auto pending = std::find_if(
+      m_commands.begin(), m_commands.end(),
+      [&](const AttributeCommand &command) {
+        return command.name == attribute_name;
+      });
+  if (pending != m_commands.end())
+    pending->inputs = setter_inputs;
+  else
+    m_commands.push_back({attribute_name, setter_inputs});
+  m_has_commands.store(true, std::memory_order_release);
+}
+
+int Backend::get_float_attribute_id(const std::string &attribute_name) {
+  auto metadata = get_metadata();
+  auto &names = metadata->float_attributes;
+  auto position = std::find(names.begin(), names.end(), attribute_name);
+  return position != names.end() ? int(position - names.begin()) : -1;
+}
+
+void Backend::set_float_attribute(int attribute_id, float value) {
+  if (attribute_id < 0 || attribute_id >= max_float_attributes)
+    return;
+  m_float_slots[attribute_id].value.store(value, std::memory_order_relaxed);
+  m_float_slots[attribute_id].dirty.store(true, std::memory_order_release);
+  m_has_float_updates.store(true, std::memory_order_release);
+}
+
+void Backend::apply_attribute_commands() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  run_attribute_commands();
+}
+
+void Backend::run_attribute_commands() {
+  if (m_has_commands.load(std::memory_order_acquire)) {
+    // NEVER WAIT FOR THE MESSAGE THREAD, BUSY QUEUES ARE RETRIED LATER
+    std::unique_lock<std::mutex> command_lock(m_command_mutex,
+                                              std::try_to_lock);
+    if (command_lock.owns_lock()) {
+      m_running_commands.swap(m_commands);
+      m_has_commands.store(false, std::memory_order_relaxed);
     }
-  } catch (...) {
-    throw "setter for " + attribute_name + " failed";
   }
+  auto float_updates =
+      m_has_float_updates.exchange(false, std::memory_order_acq_rel);
+  if (m_running_commands.empty() && !float_updates)
+    return;
+
+  auto metadata = get_metadata();
+  auto previous_values = std::atomic_load(&m_attribute_values);
+  auto values = previous_values ? std::make_shared<AttributeValues>(
+                                      *previous_values)
+                                : std::make_shared<AttributeValues>();
+  auto run_setter = [&](const std::string &name,
+                        const std::vector<c10::IValue> &inputs) {
+    try {
+      m_engine->set_attribute(name, inputs);
+      (*values)[name] = m_engine->get_attribute(name);
+    } catch (const std::exception &e) {
+      std::cerr << "setter for " << name << " failed: " << e.what() << '\n';
+    }
+  };
+  for (auto &command : m_running_commands)
+    run_setter(command.name, command.inputs);
+  m_running_commands.clear();
+
+  // TYPED UPDATES, COALESCED INTO THEIR SLOT SINCE THE PREVIOUS BUFFER
+  for (int i(0); float_updates && i < metadata->float_attributes.size(); i++) {
+    auto &slot = m_float_slots[i];
+    if (!slot.dirty.exchange(false, std::memory_order_acq_rel))
+      continue;
+    double value = slot.value.load(std::memory_order_relaxed);
+    run_setter(metadata->float_attributes[i], {c10::IValue(value)});
+  }
+  std::atomic_store(&m_attribute_values,
+                    std::shared_ptr<const AttributeValues>(values));
 }
 
-std::vector<int> Backend::get_method_params(std::string method) {
-  std::vector<int> params;
+static std::vector<std::string>
+find_labels(const std::map<std::string, std::vector<std::string>> &labels,
+            const std::string &method) {
+  auto position = labels.find(method);
+  return position != labels.end() ? position->second
+                                  : std::vector<std::string>();
+}
+
+void Backend::resolve_method_descriptors() {
+  // KEEP IDS STABLE ACROSS RELOADS, METHODS THAT DISAPPEARED BECOME UNUSABLE
+  for (auto &descriptor : m_methods)
+    descriptor.steps.clear();
+  if (!m_engine)
+    return;
 
-  if (std::find(m_available_methods.begin(), m_available_methods.end(),
-                method) != m_available_methods.end()) {
+  auto metadata = get_metadata();
+  for (const auto &method : metadata->available_methods) {
+    auto descriptor = std::find_if(
+        m_methods.begin(), m_methods.end(),
+        [&method](const MethodDescriptor &d) { return d.name == method; });
+    if (descriptor == m_methods.end()) {
+      m_methods.emplace_back();
+      m_methods.back().name = method;
+    }
+  }
+
+  // CHAINS ARE RESOLVED FROM THEIR STEPS, EACH ONE TAKING THE OUTPUT OF THE
+  // PREVIOUS ONE
+  for (auto &descriptor : m_methods) {
+    auto steps = split_method_chain(descriptor.name);
+    std::vector<int> ids;
     try {
-      std::unique_lock<std::mutex> model_lock(m_model_mutex);
-      auto p = m_model.attr(method + "_params").toTensor();
-      model_lock.unlock();
-      for (int i(0); i < 4; i++)
-        params.push_back(p[i].item().to<int>());
-    } catch (...) {
+      for (int i(0); i < steps.size(); i++) {
+        auto params = metadata->method_params.find(steps[i]);
+        auto id = m_engine->get_method(steps[i]);
+        if (params == metadata->method_params.end() ||
+            params->second.size() < 4 || id < 0)
+          throw std::runtime_error("method " + steps[i] + " not found");
+        auto &p = params->second;
+        if (i == 0) {
+          descriptor.in_dim = p[0];
+          descriptor.in_ratio = p[1];
+          descriptor.input_labels =
+              find_labels(metadata->input_labels, steps[i]);
+        } else if (p[0] != descriptor.out_dim ||
+                   p[1] != descriptor.out_ratio) {
+          throw std::runtime_error("method " + steps[i] +
+                                   " does not take the output of " +
+                                   steps[i - 1]);
+        }
+        descriptor.out_dim = p[2];
+        descriptor.out_ratio = p[3];
+        ids.push_back(id);
+      }
+      descriptor.output_labels =
+          find_labels(metadata->output_labels, steps.back());
+      descriptor.steps = ids;
+    } catch (const std::exception &e) {
+      if (steps.size() > 1)
+        std::cerr << "cannot chain " << descriptor.name << ": " << e.what()
+                  << '\n';
     }
   }
-  return params;
+}
+
+std::vector<std::string>
+Backend::split_method_chain(const std::string &method) {
+  std::vector<std::string> steps;
+  size_t start = 0;
+  while (true) {
+    auto end = method.find('>', start);
+    steps.push_back(method.substr(start, end - start));
+    if (end == std::string::npos)
+      break;
+    start = end + 1;
+  }
+  return steps;
+}
+
+int Backend::get_method_id(const std::string &method) {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  bool known = false;
+  for (int i(0); i < m_methods.size(); i++) {
+    if (m_methods[i].name != method)
+      continue;
+    if (!m_methods[i].steps.empty())
+      return i;
+    known = true;
+  }
+  // A CHAIN GETS ITS DESCRIPTOR THE FIRST TIME IT IS REQUESTED
+  if (known || !m_loaded || split_method_chain(method).size() < 2)
+    return -1;
+  m_methods.emplace_back();
+  m_methods.back().name = method;
+  resolve_method_descriptors();
+  for (int i(0); i < m_methods.size(); i++) {
+    if (m_methods[i].name == method && !m_methods[i].steps.empty())
+      return i;
+  }
+  return -1;
+}
+
+const MethodDescriptor *Backend::get_method_descriptor(int method_id) {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  if (method_id < 0 || method_id >= m_methods.size())
+    return nullptr;
+  return &m_methods[method_id];
+}
+
+std::vector<int> Backend::get_method_params(std::string method) {
+  auto metadata = get_metadata();
+  std::vector<int> chain_params;
+  for (const auto &step : split_method_chain(method)) {
+    auto params = metadata->method_params.find(step);
+    if (params == metadata->method_params.end() || params->second.size() < 4)
+      return {};
+    if (chain_params.empty()) {
+      chain_params = params->second;
+      continue;
+    }
+    // THE OUTPUT OF THE PREVIOUS STEP MUST MATCH THE INPUT OF THIS ONE
+    if (params->second[0] != chain_params[2] ||
+        params->second[1] != chain_params[3])
+      return {};
+    chain_params[2] = params->second[2];
+    chain_params[3] = params->second[3];
+  }
+  return chain_params;
 }
 
 int Backend::get_higher_ratio() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
   int higher_ratio = 1;
-  for (const auto &method : m_available_methods) {
-    auto params = get_method_params(method);
-    if (!params.size())
+  for (const auto &descriptor : m_methods) {
+    if (descriptor.steps.empty())
       continue; // METHOD NOT USABLE, SKIPPING
-    int max_ratio = std::max(params[1], params[3]);
+    int max_ratio = std::max(descriptor.in_ratio, descriptor.out_ratio);
     higher_ratio = std::max(higher_ratio, max_ratio);
   }
   return higher_ratio;
@@ -373,21 +752,256 @@ int Backend::get_higher_ratio() {
 
 bool Backend::is_loaded() { return m_loaded; }
 
+EngineSettings Backend::get_engine_settings() {
+  EngineSettings settings;
+  settings.device = m_device;
+  settings.shared = m_use_batching;
+  settings.optimization_level = m_optimization_level;
+  settings.precision = m_precision;
+  return settings;
+}
+
+std::string Backend::get_path() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  return m_path;
+}
+
+// "cpu", "cuda", "cuda:<index>", "mps" OR "gpu" (THE FIRST ACCELERATOR),
+// NULLOPT IF UNKNOWN OR UNAVAILABLE
+static std::optional<c10::Device> parse_device(const std::string &name) {
+  if (name == "gpu") {
+    if (torch::hasCUDA())
+      return c10::Device(CUDA, 0);
+    if (torch::hasMPS())
+      return c10::Device(MPS, 0);
+    return c10::Device(CPU);
+  }
+  try {
+    c10::Device device(name);
+    // EXPLICIT INDICES, SO THAT "cuda" AND "cuda:0" SHARE THE SAME WEIGHTS
+    if (device.is_cuda() || device.is_mps())
+      device = c10::Device(device.type(), std::max<int>(device.index(), 0));
+    if (device.is_cuda() && device.index() < int(torch::cuda::device_count()))
+      return device;
+    if (device.is_mps() && device.index() == 0 && torch::hasMPS())
+      return device;
+    if (device.is_cpu())
+      return device;
+  } catch (...) {
+  }
+  return std::nullopt;
+}
+
 void Backend::use_gpu(bool value) {
   std::unique_lock<std::mutex> model_lock(m_model_mutex);
-  if (value) {
-    if (torch::hasCUDA()) {
-      std::cout << "sending model to cuda" << std::endl;
-      m_device = CUDA;
-    } else if (torch::hasMPS()) {
-      std::cout << "sending model to mps" << std::endl;
-      m_device = MPS;
+  m_device_name = value ? "gpu" : "cpu";
+  model_lock.unlock();
+  place_model();
+}
+
+int Backend::set_device(std::string device) {
+  if (device != "auto" && !parse_device(device)) {
+    std::cerr << "unknown or unavailable device " << device
+              << ", expected cpu, cuda[:index], mps, gpu or auto" << std::endl;
+    return 1;
+  }
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  m_device_name = device;
+  model_lock.unlock();
+  place_model();
+  return 0;
+}
+
+std::string Backend::get_device() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  return m_device.str();
+}
+
+// ONE STREAM PER INSTANCE, SO THAT THE TRANSFERS AND COMPUTATIONS OF SEVERAL
+// INSTANCES OVERLAP ON THE DEVICE
+void Backend::update_stream() {
+  if (m_device.is_cuda() && (!m_stream || m_stream->device() != m_device))
+    m_stream = c10::impl::getDeviceGuardImpl(CUDA)->getStreamFromGlobalPool(
+        m_device, true);
+  else if (!m_device.is_cuda())
+    m_stream = std::nullopt;
+}
+
+// MOVES THE MODEL TO THE REQUESTED DEVICE. "auto" IS RESOLVED ONCE THE PATH OF
+// THE MODEL IS KNOWN, AND KEPT UNTIL ANOTHER DEVICE IS REQUESTED
+void Backend::place_model() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  auto previous_device = m_device;
+  if (m_device_name != "auto") {
+    m_device_lease = nullptr;
+    m_device = parse_device(m_device_name).value_or(c10::Device(CPU));
+  } else if (m_loaded && !m_device_lease) {
+    m_device_lease = DevicePlacement::get().acquire(m_path, m_use_batching);
+    m_device = m_device_lease->device;
+  }
+  update_stream();
+
+  if (m_device == previous_device)
+    return;
+  std::cout << "sending model to " << m_device.str() << std::endl;
+  if (!m_loaded)
+    return;
+
+  // THE ENGINE SWITCHES TO THE COPY OF THE MODEL LIVING ON THE NEW DEVICE
+  try {
+    m_engine = m_engine->reconfigure(get_engine_settings());
+    m_effective_precision = m_engine->get_precision();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return;
+  }
+  resolve_method_descriptors();
+  model_lock.unlock();
+  update_batch_groups();
+  warm_up();
+}
+
+void Backend::use_linear_interpolation(bool value) {
+  m_linear_interpolation = value;
+}
+
+void Backend::use_input_averaging(bool value) { m_input_averaging = value; }
+
+void Backend::use_batching(bool value) {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  if (value == m_use_batching)
+    return;
+  m_use_batching = value;
+
+  // BATCHED INSTANCES ALL RUN ON THE SAME COPY OF THE MODEL, THUS SHARING ITS
+  // ATTRIBUTES AND BUFFERS WITH THE REST OF THE GROUP
+  if (m_loaded) {
+    try {
+      m_engine = m_engine->reconfigure(get_engine_settings());
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << '\n';
+      m_use_batching = !value;
+    }
+    std::atomic_store(&m_attribute_values,
+                      read_attribute_values(*m_engine, *get_metadata()));
+    resolve_method_descriptors();
+  }
+  model_lock.unlock();
+  update_batch_groups();
+}
+
+void Backend::update_batch_groups() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  for (auto &descriptor : m_methods) {
+    auto &buffers = descriptor.buffers;
+    auto key = m_engine ? m_engine->get_batching_key() : nullptr;
+    if (m_use_batching && key && descriptor.steps.size() == 1 &&
+        buffers.input.defined()) {
+      buffers.batch_member = nullptr; // GIVES ITS SLOT BACK FIRST
+      buffers.batch_member = BatchScheduler::get().join(
+          key, descriptor.name, buffers.n_vec, buffers.n_batches);
     } else {
-      std::cout << "sending model to cpu" << std::endl;
-      m_device = CPU;
+      buffers.batch_member = nullptr;
     }
-  } else {
-    m_device = CPU;
   }
-  m_model.to(m_device);
-}
\ No newline at end of file
+}
+
+void Backend::set_optimization_level(int level) {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  m_optimization_level = std::clamp(level, int(OPTIMIZE_NONE),
+                                    int(OPTIMIZE_INFERENCE));
+}
+
+int Backend::set_precision(std::string precision) {
+  auto value = precision_from_string(precision);
+  if (value == PRECISION_INT8) {
+    std::cerr << "int8 cannot be applied at load time, quantize the model "
+                 "with torch.ao.quantization.quantize_dynamic before "
+                 "scripting it (it then runs in int8 in any precision)"
+              << std::endl;
+    return 1;
+  }
+  if (value < 0) {
+    std::cerr << "unknown precision " << precision
+              << ", expected fp32, fp16 or bf16" << std::endl;
+    return 1;
+  }
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  m_precision = value;
+  return 0;
+}
+
+int Backend::set_engine(std::string engine) {
+  if (!has_engine(engine)) {
+    std::cerr << "unknown engine " << engine << std::endl;
+    return 1;
+  }
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  m_engine_name = engine == "auto" ? "" : engine;
+  return 0;
+}
+
+std::string Backend::get_engine() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  return m_engine_name.empty() ? "auto" : m_engine_name;
+}
+
+std::string Backend::get_precision() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  return precision_name(m_effective_precision);
+}
+
+void Backend::use_model_cache(bool value) { ::use_model_cache(value); }
+
+void Backend::use_profiling_executor(bool value) {
+  torch::jit::getProfilingMode() = value;
+}
+
+void Backend::set_warmup(int n_iterations, int n_vec, int n_batches) {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  m_warmup_iterations = n_iterations;
+  m_warmup_n_vec = n_vec;
+  m_warmup_n_batches = n_batches;
+  model_lock.unlock();
+  warm_up();
+}
+
+void Backend::warm_up() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  if (!m_loaded || m_warmup_iterations <= 0 || m_warmup_n_vec <= 0)
+    return;
+  auto engine = m_engine;
+  auto n_iterations = m_warmup_iterations;
+  auto n_vec = m_warmup_n_vec;
+  auto n_batches = m_warmup_n_batches;
+  model_lock.unlock();
+  engine->warm_up(n_iterations, n_vec, n_batches);
+}
+
+void Backend::set_intra_op_threads(int n_threads) {
+  m_intra_op_threads = std::max(n_threads, 0);
+#if !AT_PARALLEL_OPENMP
+  if (n_threads > 0)
+    std::cerr << "per instance thread budgets need an OpenMP build of "
+                 "libtorch, using the global budget"
+              << std::endl;
+#endif
+}
+
+void Backend::set_thread_budget(int intra_op_threads, int inter_op_threads) {
+  try {
+    if (intra_op_threads > 0) {
+      global_intra_op_threads = intra_op_threads;
+      at::set_num_threads(intra_op_threads);
+    }
+    // ONLY POSSIBLE BEFORE THE FIRST INTER-OP TASK, LIBTORCH THROWS OTHERWISE
+    if (inter_op_threads > 0)
+      at::set_num_interop_threads(inter_op_threads);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+  }
+}
+
+std::vector<int> Backend::get_thread_budget() {
+  return {global_intra_op_threads, at::get_num_interop_threads()};
+}
@@ -1,24 +1,122 @@
 #pragma once
+#include "engine.h"
+#include "perf_stats.h"
+#include <atomic>
+#include <c10/core/Stream.h>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <torch/script.h>
 #include <torch/torch.h>
 #include <vector>
 
+class BatchMember;
+struct DeviceLease;
+
+// PREALLOCATED MODEL INPUT (FILLED UNDER THE MODEL LOCK) AND OUTPUT
+struct PreparedBuffers {
+  at::Tensor input;  // [n_batches, in_dim, n_vec / in_ratio]
+  at::Tensor output; // [n_batches, out_dim, n_vec / out_ratio], host memory
+  at::Tensor device_input; // copy of the input living on the model device
+  at::Tensor history; // last output frame, for linear expansion
+  std::shared_ptr<BatchMember> batch_member; // set when batching is enabled
+  int n_vec = 0;
+  int n_batches = 0;
+};
+
+// METHOD METADATA, RESOLVED ONCE WHEN THE MODEL IS LOADED
+struct MethodDescriptor {
+  std::string name;
+  int in_dim = 0, in_ratio = 1, out_dim = 0, out_ratio = 1;
+  std::vector<std::string> input_labels, output_labels;
+  // ENGINE METHOD IDS, RUN ONE AFTER THE OTHER. EMPTY IF THE METHOD IS UNUSABLE
+  std::vector<int> steps;
+  PreparedBuffers buffers;
+};
+
+// CURRENT VALUES OF THE SETTABLE ATTRIBUTES, REPLACED AS A WHOLE
+using AttributeValues = std::map<std::string, std::vector<c10::IValue>>;
+
+// SETTER CALL QUEUED BY THE MESSAGE THREAD
+struct AttributeCommand {
+  std::string name;
+  std::vector<c10::IValue> inputs;
+};
+
+// LATEST VALUE OF A FLOAT ATTRIBUTE, WRITTEN WITHOUT LOCKING (E.G. FROM THE
+// AUDIO THREAD) AND APPLIED ONCE PER BUFFER
+struct FloatAttributeSlot {
+  std::atomic<float> value{0.f};
+  std::atomic<bool> dirty{false};
+};
+
 class Backend {
 protected:
-  torch::jit::script::Module m_model;
+  std::shared_ptr<Engine> m_engine; // replaced as a whole, never modified
+  std::string m_engine_name;        // empty to select it from the model path
   int m_loaded;
   std::string m_path;
   std::mutex m_model_mutex;
-  std::vector<std::string> m_available_methods;
-  c10::DeviceType m_device;
-  bool m_use_gpu;
+  std::shared_ptr<const ModelMetadata> m_metadata;
+  std::shared_ptr<const AttributeValues> m_attribute_values;
+  std::mutex m_command_mutex; // only guards the command queue
+  std::vector<AttributeCommand> m_commands, m_running_commands;
+  std::atomic<bool> m_has_commands{false};
+  FloatAttributeSlot m_float_slots[max_float_attributes];
+  std::atomic<bool> m_has_float_updates{false};
+  std::atomic<int> m_intra_op_threads{0}; // 0 for the global budget
+  PerfStats m_stats;
+  std::atomic<bool> m_input_averaging{false};
+  // SET FROM THE MAIN THREAD, READ BY THE COMPUTE AND AUDIO THREADS
+  std::atomic<bool> m_linear_interpolation{false}, m_use_batching{false};
+  c10::Device m_device;
+  std::string m_device_name; // requested device, "auto" for DevicePlacement
+  std::shared_ptr<DeviceLease> m_device_lease; // set when placed by "auto"
+  std::optional<c10::Stream> m_stream; // cuda stream of this instance
+  // DESCRIPTORS NEVER MOVE, CHAINS BEING ADDED WHILE OTHER THREADS READ THEM
+  std::deque<MethodDescriptor> m_methods;
+  int m_optimization_level;
+  int m_precision, m_effective_precision; // requested and actual Precision
+  int m_warmup_iterations, m_warmup_n_vec, m_warmup_n_batches;
+  std::atomic<bool> m_loading{false};
+  std::future<void> m_load_future; // last member, joined first on deletion
+
+  EngineSettings get_engine_settings(); // model lock held
+  void update_stream();                 // model lock held
+  void place_model();
+  void resolve_method_descriptors(); // model lock held
+  int load_model(std::string path, bool force_reload);
+  int load_model_async(std::string path, bool force_reload,
+                       std::function<void(int)> callback);
+  void update_batch_groups();
+  void warm_up();
+  void run_attribute_commands(); // model lock held
+  // BODY OF perform AND perform_prepared, in_buffer IS BATCH MAJOR AT THE
+  // AUDIO RATE (DECIMATED BY in_ratio WHILE COPIED) IF decimate IS SET
+  void perform_method(const std::vector<float *> &in_buffer,
+                      const std::vector<float *> &out_buffer, int n_vec,
+                      int method_id, int n_batches, bool decimate);
 
 public:
   Backend();
   void perform(std::vector<float *> in_buffer, std::vector<float *> out_buffer,
                int n_vec, std::string method, int n_batches);
+  // ALLOCATES THE INPUT / OUTPUT TENSORS OF A METHOD FOR UP TO n_batches
+  // BATCHES. perform_prepared ACCEPTS ANY SMALLER BATCH WITHOUT REALLOCATING,
+  // RUNNING THE MODEL ON THE FIRST n_batches BATCHES OF THE INPUT.
+  int prepare(int method_id, int n_vec, int n_batches);
+  // COPIES in_buffer (n_vec / in_ratio FRAMES, INDEXED batch * in_dim +
+  // channel) INTO THE PREPARED INPUT UNDER THE MODEL LOCK, THEN RUNS THE MODEL.
+  // THE COPY IS DELIBERATE: prepare (E.G. AFTER A RELOAD) REALLOCATES THE
+  // TENSOR, SO NO POINTER TO IT IS EVER HANDED OUT TO THE FRONTENDS
+  void perform_prepared(const std::vector<float *> &in_buffer,
+                        const std::vector<float *> &out_buffer, int n_vec,
+                        int method_id, int n_batches);
   bool has_method(std::string method_name);
   bool has_settable_attribute(std::string attribute);
   std::vector<std::string> get_available_methods();
@@ -26,14 +124,89 @@ public:
   std::vector<std::string> get_settable_attributes();
   std::vector<c10::IValue> get_attribute(std::string attribute_name);
   std::string get_attribute_as_string(std::string attribute_name);
+  // QUEUES THE SETTER CALL, APPLIED BY THE NEXT BUFFER OR BY
+  // apply_attribute_commands. THROWS IF THE ARGUMENTS ARE INVALID.
   void set_attribute(std::string attribute_name,
                      std::vector<std::string> attribute_args);
+  // SAME, WITH THE VALUES ALREADY TYPED (E.G. AS RETURNED BY get_attribute)
+  void set_attribute(std::string attribute_name,
+                     std::vector<c10::IValue> setter_inputs);
+  void apply_attribute_commands();
+  // TYPED, LOCK FREE AND ALLOCATION FREE PATH FOR THE ATTRIBUTES TAKING A
+  // SINGLE FLOAT, SAFE TO CALL FROM THE AUDIO THREAD. ONLY THE LATEST VALUE
+  // IS APPLIED, ON THE NEXT BUFFER (OR BY apply_attribute_commands). IDS ARE
+  // -1 FOR OTHER ATTRIBUTES, AND MUST BE RESOLVED AGAIN AFTER A RELOAD.
+  int get_float_attribute_id(const std::string &attribute_name);
+  void set_float_attribute(int attribute_id, float value);
+  std::shared_ptr<const ModelMetadata> get_metadata();
 
+  // A METHOD NAME MAY CHAIN SEVERAL METHODS WITH '>' (E.G. "encode>decode"),
+  // RUN ONE AFTER THE OTHER IN A SINGLE CALL, THE INTERMEDIATE TENSORS
+  // STAYING ON THE MODEL DEVICE. THE OUTPUT OF EACH METHOD MUST MATCH THE
+  // INPUT OF THE NEXT ONE.
+  static std::vector<std::string> split_method_chain(const std::string &method);
+  int get_method_id(const std::string &method);
+  // VALID AS LONG AS THE BACKEND, UPDATED IN PLACE WHEN THE MODEL IS RELOADED
+  const MethodDescriptor *get_method_descriptor(int method_id);
   std::vector<int> get_method_params(std::string method);
   int get_higher_ratio();
   int load(std::string path);
   int reload();
+  // LOAD IN A BACKGROUND THREAD, THE CURRENT MODEL KEEPS RUNNING UNTIL THE NEW
+  // ONE IS SWAPPED IN BETWEEN TWO BUFFERS. THE CALLBACK IS CALLED FROM THE
+  // LOADING THREAD WITH THE RETURN CODE OF THE LOAD. RETURNS 1 IF A LOAD IS
+  // ALREADY RUNNING.
+  int load_async(std::string path, std::function<void(int)> callback);
+  int reload_async(std::function<void(int)> callback);
+  bool is_loading();
+  // BLOCKS UNTIL THE BACKGROUND LOAD (AND ITS CALLBACK) IS OVER. THE OWNERS OF
+  // CALLBACKS CAPTURING THEM CALL IT BEFORE DESTROYING ANY OF THEIR MEMBERS
+  void wait_for_load();
   bool is_loaded();
-  torch::jit::script::Module get_model() { return m_model; }
+  std::string get_path();
+  // SELECTS THE FIRST ACCELERATOR (CUDA, THEN MPS) IF value, THE CPU OTHERWISE
   void use_gpu(bool value);
+  // "cpu", "cuda", "cuda:<index>", "mps", "gpu" (AS use_gpu(true)) OR "auto",
+  // WHICH PLACES THE MODEL ON THE LEAST LOADED ACCELERATOR (SEE
+  // DevicePlacement). THE MODEL MOVES RIGHT AWAY IF IT IS LOADED. RETURNS 1 IF
+  // THE DEVICE IS UNKNOWN OR UNAVAILABLE. get_device RETURNS THE DEVICE IN USE.
+  int set_device(std::string device);
+  std::string get_device();
+  void use_linear_interpolation(bool value);
+  // DECIMATES THE INPUT OF Backend::perform BY AVERAGING (BOX FILTER) RATHER
+  // THAN BY KEEPING ONE SAMPLE PER RATIO
+  void use_input_averaging(bool value);
+  void use_batching(bool value);
+  // LOAD TIME GRAPH OPTIMIZATION (SEE OptimizationLevel), APPLIED ON THE NEXT
+  // (RE)LOAD
+  void set_optimization_level(int level);
+  // INFERENCE ENGINE RUNNING THE MODEL (SEE engine.h), APPLIED ON THE NEXT
+  // (RE)LOAD. "auto" (THE DEFAULT) SELECTS IT FROM THE EXTENSION OF THE MODEL
+  // FILE. RETURNS 1 IF NO ENGINE HAS THAT NAME.
+  int set_engine(std::string engine);
+  std::string get_engine();
+  // PRECISION OF THE MODEL ("fp32", "fp16" OR "bf16"), APPLIED ON THE NEXT
+  // (RE)LOAD. THE WEIGHTS ARE CONVERTED ONCE, THE INPUTS AND OUTPUTS ARE CAST
+  // AROUND EACH CALL. RETURNS 1 IF THE PRECISION IS UNKNOWN OR "int8", WHICH
+  // ONLY MODELS QUANTIZED BEFORE EXPORT RUN IN. get_precision RETURNS THE ONE
+  // IN USE, fp32 IF THE MODEL DOES NOT SUPPORT THE REQUESTED ONE.
+  int set_precision(std::string precision);
+  std::string get_precision();
+  // SELECTS THE PROFILING (DEFAULT) OR THE LEGACY GRAPH EXECUTOR, PROCESS-WIDE
+  static void use_profiling_executor(bool value);
+  // KEEPS THE OPTIMIZED / CONVERTED MODELS IN AN ON-DISK CACHE, PROCESS-WIDE
+  static void use_model_cache(bool value);
+  // NUMBER OF INTRA-OP THREADS THIS INSTANCE MAY USE DURING ITS FORWARD PASS,
+  // CAPPED BY THE GLOBAL BUDGET (0 FOR THE GLOBAL BUDGET ITSELF)
+  void set_intra_op_threads(int n_threads);
+  // PROCESS-WIDE INTRA-OP AND INTER-OP THREAD COUNTS (IGNORED IF <= 0)
+  static void set_thread_budget(int intra_op_threads, int inter_op_threads);
+  static std::vector<int> get_thread_budget();
+  // TIMINGS OF THE MODEL CALLS, DEADLINE MISSES AND QUEUE DEPTH (THE LAST TWO
+  // ARE RECORDED BY THE FRONTENDS)
+  PerfStats &get_stats() { return m_stats; }
+  // NUMBER OF CALLS RUN ON ZERO INPUTS WITH THE RUNTIME SHAPE OF EVERY METHOD,
+  // RIGHT AWAY AND AFTER EVERY LOAD, SO THAT THE JIT IS DONE PROFILING AND
+  // OPTIMIZING BEFORE THE FIRST AUDIO BUFFER
+  void set_warmup(int n_iterations, int n_vec, int n_batches);
 };
@@ -0,0 +1,195 @@
+#include "batch_scheduler.h"
+#include "engine.h"
+#include <c10/core/impl/DeviceGuardImplInterface.h>
+#include <cstdint>
+#include <iostream>
+
+BatchGroup::BatchGroup(std::shared_ptr<std::mutex> execution_mutex)
+    : m_execution_mutex(execution_mutex) {}
+
+at::Tensor BatchGroup::run(int slot, Engine &engine, int method,
+                           const at::Tensor &input) {
+  std::unique_lock<std::mutex> group_lock(m_mutex);
+  m_slots[slot].idle = false;
+  if (!m_collecting)
+    m_collecting = std::make_shared<Round>();
+  auto round = m_collecting;
+  bool leader = !round->n_submitted;
+  if (slot >= round->inputs.size())
+    round->inputs.resize(m_slots.size());
+  round->inputs[slot] = input;
+  round->n_submitted++;
+
+  if (!leader) {
+    // FOLLOWER, WAKE UP THE LEADER IF EVERYONE IS THERE AND WAIT FOR RESULTS
+    if (round->n_submitted >= awaited_members())
+      m_condition.notify_all();
+    m_condition.wait(group_lock, [&round] { return round->done; });
+    return slot < round->outputs.size() ? round->outputs[slot]
+                                        : at::Tensor();
+  }
+
+  // LEADER, WAIT FOR THE OTHER MEMBERS UNTIL THE GATHER WINDOW IS OVER
+  m_condition.wait_for(
+      group_lock, BatchScheduler::get().get_gather_timeout(),
+      [this, &round] { return round->n_submitted >= awaited_members(); });
+  m_collecting = nullptr;
+  round->inputs.resize(m_slots.size());
+  for (int s(0); s < m_slots.size(); s++) {
+    if (m_slots[s].used && !round->inputs[s].defined())
+      m_slots[s].idle = true;
+  }
+  round->slots = m_slots;
+  group_lock.unlock();
+
+  std::vector<at::Tensor> outputs(round->slots.size());
+  try {
+    std::unique_lock<std::mutex> execution_lock(*m_execution_mutex);
+    // EVERY SLOT KEEPS ITS ROWS, MISSING MEMBERS AND VOICES ARE SILENT
+    int n_rows = 0;
+    for (const auto &s : round->slots)
+      n_rows += s.n_batches;
+    auto sizes = input.sizes().vec();
+    sizes[0] = n_rows;
+    if (!m_batch.defined() || m_batch.sizes() != sizes ||
+        m_batch.scalar_type() != input.scalar_type() ||
+        m_batch.device() != input.device())
+      m_batch = torch::zeros(sizes, input.options());
+
+    int offset = 0;
+    for (int s(0); s < round->slots.size(); s++) {
+      auto n_batches = round->slots[s].n_batches;
+      auto rows = m_batch.narrow(0, offset, n_batches);
+      const auto &tensor_in = round->inputs[s];
+      int n_in = tensor_in.defined()
+                     ? std::min(int(tensor_in.size(0)), n_batches)
+                     : 0;
+      if (n_in)
+        rows.narrow(0, 0, n_in).copy_(tensor_in.narrow(0, 0, n_in));
+      if (n_in < n_batches)
+        rows.narrow(0, n_in, n_batches - n_in).zero_();
+      offset += n_batches;
+    }
+
+    auto tensor_out = engine.run(method, m_batch);
+    // THE BATCH IS OVERWRITTEN BY THE NEXT ROUND, BEFORE THE MEMBERS OF THIS
+    // ONE ARE DONE READING THEIR OUTPUT
+    if (tensor_out.is_alias_of(m_batch))
+      tensor_out = tensor_out.clone();
+    execution_lock.unlock();
+
+    offset = 0;
+    for (int s(0); s < round->slots.size(); s++) {
+      const auto &tensor_in = round->inputs[s];
+      if (tensor_in.defined())
+        outputs[s] = tensor_out.narrow(
+            0, offset,
+            std::min(int(tensor_in.size(0)), round->slots[s].n_batches));
+      offset += round->slots[s].n_batches;
+    }
+
+    // THE OTHER MEMBERS READ THE OUTPUT FROM THEIR OWN STREAMS
+    if (tensor_out.is_cuda())
+      c10::impl::getDeviceGuardImpl(c10::kCUDA)
+          ->getStream(tensor_out.device())
+          .synchronize();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    outputs.clear();
+  }
+
+  group_lock.lock();
+  round->outputs = std::move(outputs);
+  round->done = true;
+  m_condition.notify_all();
+  return slot < round->outputs.size() ? round->outputs[slot] : at::Tensor();
+}
+
+int BatchGroup::awaited_members() {
+  int n_members = 0;
+  for (const auto &s : m_slots)
+    n_members += s.used && !s.idle;
+  return n_members;
+}
+
+int BatchGroup::add_member(int n_batches) {
+  std::unique_lock<std::mutex> group_lock(m_mutex);
+  // FREED SLOTS ARE REUSED, SO THAT THE OTHER MEMBERS KEEP THEIR ROWS
+  int slot(0);
+  while (slot < m_slots.size() && m_slots[slot].used)
+    slot++;
+  if (slot == m_slots.size())
+    m_slots.emplace_back();
+  m_slots[slot] = {std::max(n_batches, 1), true, false};
+  return slot;
+}
+
+void BatchGroup::remove_member(int slot) {
+  std::unique_lock<std::mutex> group_lock(m_mutex);
+  m_slots[slot].used = false;
+  m_slots[slot].idle = false;
+  // ONLY THE TRAILING FREE SLOTS ARE DROPPED FROM THE BATCH
+  while (m_slots.size() && !m_slots.back().used)
+    m_slots.pop_back();
+  m_condition.notify_all();
+}
+
+BatchMember::BatchMember(std::shared_ptr<BatchGroup> group, int n_batches)
+    : m_group(group), m_slot(group->add_member(n_batches)) {}
+
+BatchMember::~BatchMember() { m_group->remove_member(m_slot); }
+
+at::Tensor BatchMember::run(Engine &engine, int method,
+                            const at::Tensor &input) {
+  return m_group->run(m_slot, engine, method, input);
+}
+
+BatchScheduler &BatchScheduler::get() {
+  static BatchScheduler scheduler;
+  return scheduler;
+}
+
+std::shared_ptr<BatchMember> BatchScheduler::join(const void *model,
+                                                  const std::string &method,
+                                                  int n_vec, int n_batches) {
+  auto key = std::to_string(reinterpret_cast<uintptr_t>(model)) + "/" +
+             method + "/" + std::to_string(n_vec);
+  std::unique_lock<std::mutex> scheduler_lock(m_mutex);
+
+  // FORGET GROUPS WITHOUT MEMBERS, AND MODELS WITHOUT GROUPS
+  for (auto it = m_groups.begin(); it != m_groups.end();) {
+    if (it->second.expired())
+      it = m_groups.erase(it);
+    else
+      it++;
+  }
+  for (auto it = m_execution_mutexes.begin();
+       it != m_execution_mutexes.end();) {
+    if (it->second.expired())
+      it = m_execution_mutexes.erase(it);
+    else
+      it++;
+  }
+
+  auto group = m_groups[key].lock();
+  if (!group) {
+    // EVERY GROUP OF THE MODEL RUNS IT UNDER THE SAME MUTEX
+    auto execution_mutex = m_execution_mutexes[model].lock();
+    if (!execution_mutex) {
+      execution_mutex = std::make_shared<std::mutex>();
+      m_execution_mutexes[model] = execution_mutex;
+    }
+    group = std::make_shared<BatchGroup>(execution_mutex);
+    m_groups[key] = group;
+  }
+  scheduler_lock.unlock();
+  return std::make_shared<BatchMember>(group, n_batches);
+}
+
+void BatchScheduler::set_gather_timeout(std::chrono::microseconds timeout) {
+  m_gather_timeout_us = timeout.count();
+}
+
+std::chrono::microseconds BatchScheduler::get_gather_timeout() {
+  return std::chrono::microseconds(m_gather_timeout_us.load());
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <torch/script.h>
+#include <vector>
+
+class Engine;
+
+// Gathers the buffers submitted by every instance sharing the same model,
+// method and buffer size, stacks them along the batch dimension and runs
+// the method once for the whole group. Each member owns a fixed slot of rows
+// in the batch, the rows of the members missing from a round being silent, so
+// that a stateful model always sees the same voice at the same index and the
+// same batch size. A member missing a round is not waited for anymore until
+// it submits again, so that a disabled instance only delays a single round.
+// The groups of the same model (other methods or buffer sizes) share one
+// execution mutex, the module not being reentrant.
+class BatchGroup {
+public:
+  BatchGroup(std::shared_ptr<std::mutex> execution_mutex);
+  // BLOCKS UNTIL THE BATCH CONTAINING input HAS BEEN PROCESSED, AND RETURNS
+  // THE ROWS OF THE OUTPUT OF THE SLOT (UNDEFINED IF THE CALL FAILED). THE
+  // ENGINE OF THE FIRST MEMBER TO SUBMIT RUNS THE WHOLE BATCH.
+  at::Tensor run(int slot, Engine &engine, int method,
+                 const at::Tensor &input);
+  // RESERVES n_batches ROWS OF THE BATCH, RETURNS THE SLOT OF THE MEMBER
+  int add_member(int n_batches);
+  void remove_member(int slot);
+
+protected:
+  struct Slot {
+    int n_batches = 0;
+    bool used = false;
+    bool idle = false; // missed the last round
+  };
+  struct Round {
+    std::vector<at::Tensor> inputs, outputs; // indexed by slot
+    std::vector<Slot> slots;                 // layout of the batch
+    int n_submitted = 0;
+    bool done = false;
+  };
+  int awaited_members(); // group lock held
+
+  std::mutex m_mutex;
+  std::shared_ptr<std::mutex> m_execution_mutex; // shared by the model groups
+  std::condition_variable m_condition;
+  std::vector<Slot> m_slots;
+  std::shared_ptr<Round> m_collecting;
+  at::Tensor m_batch; // reused by every round, guarded by m_execution_mutex
+};
+
+// Membership of an instance in a batch group, holding its slot until
+// destroyed.
+class BatchMember {
+public:
+  BatchMember(std::shared_ptr<BatchGroup> group, int n_batches);
+  ~BatchMember();
+  at::Tensor run(Engine &engine, int method, const at::Tensor &input);
+
+protected:
+  std::shared_ptr<BatchGroup> m_group;
+  int m_slot;
+};
+
+class BatchScheduler {
+public:
+  static BatchScheduler &get();
+
+  // JOINS THE GROUP WITH UP TO n_batches BATCHES PER CALL
+  std::shared_ptr<BatchMember> join(const void *model,
+                                    const std::string &method, int n_vec,
+                                    int n_batches);
+  void set_gather_timeout(std::chrono::microseconds timeout);
+  std::chrono::microseconds get_gather_timeout();
+
+protected:
+  std::mutex m_mutex;
+  std::map<std::string, std::weak_ptr<BatchGroup>> m_groups;
+  std::map<const void *, std::weak_ptr<std::mutex>> m_execution_mutexes;
+  std::atomic<long long> m_gather_timeout_us{2000};
+};
@@ -0,0 +1,102 @@
+#include "device_placement.h"
+#include <torch/torch.h>
+
+// WEIGHT OF THE LAST CALL IN THE MOVING AVERAGE OF THE LATENCY
+constexpr double latency_smoothing = 0.05;
+
+DeviceLease::~DeviceLease() { DevicePlacement::get().release(device, path); }
+
+DevicePlacement &DevicePlacement::get() {
+  static DevicePlacement placement;
+  return placement;
+}
+
+DevicePlacement::DevicePlacement() {
+  for (int i(0); i < int(torch::cuda::device_count()); i++)
+    m_devices.push_back(
+        std::make_unique<DeviceLoad>(c10::Device(torch::kCUDA, i)));
+  if (torch::hasMPS())
+    m_devices.push_back(
+        std::make_unique<DeviceLoad>(c10::Device(torch::kMPS, 0)));
+  if (m_devices.empty())
+    m_devices.push_back(std::make_unique<DeviceLoad>(c10::Device(torch::kCPU)));
+}
+
+std::vector<c10::Device> DevicePlacement::get_devices() {
+  std::vector<c10::Device> devices;
+  for (const auto &load : m_devices)
+    devices.push_back(load->device);
+  return devices;
+}
+
+std::shared_ptr<DeviceLease> DevicePlacement::acquire(const std::string &path,
+                                                      bool batching) {
+  std::unique_lock<std::mutex> placement_lock(m_mutex);
+  DeviceLoad *chosen = nullptr;
+
+  // A BATCH GROUP ONLY GATHERS THE INSTANCES OF A MODEL ON THE SAME DEVICE
+  int most_instances = 0;
+  for (const auto &load : m_devices) {
+    auto model = load->models.find(path);
+    if (batching && model != load->models.end() &&
+        model->second > most_instances) {
+      chosen = load.get();
+      most_instances = model->second;
+    }
+  }
+
+  if (!chosen) {
+    // DEVICES WITHOUT MEASUREMENTS YET ARE ASSUMED AS FAST AS THE AVERAGE
+    double latency_sum = 0;
+    int n_measured = 0;
+    for (const auto &load : m_devices) {
+      auto latency = load->latency.load(std::memory_order_relaxed);
+      if (latency > 0) {
+        latency_sum += latency;
+        n_measured++;
+      }
+    }
+    double default_latency = n_measured ? latency_sum / n_measured : 1;
+    double lowest_cost = 0;
+    for (const auto &load : m_devices) {
+      auto latency = load->latency.load(std::memory_order_relaxed);
+      auto cost = (latency > 0 ? latency : default_latency) *
+                  (load->instances + 1);
+      if (!chosen || cost < lowest_cost) {
+        chosen = load.get();
+        lowest_cost = cost;
+      }
+    }
+  }
+
+  chosen->instances++;
+  chosen->models[path]++;
+  return std::shared_ptr<DeviceLease>(new DeviceLease{chosen->device, path});
+}
+
+void DevicePlacement::release(const c10::Device &device,
+                              const std::string &path) {
+  std::unique_lock<std::mutex> placement_lock(m_mutex);
+  for (const auto &load : m_devices) {
+    if (load->device != device)
+      continue;
+    load->instances--;
+    if (--load->models[path] <= 0)
+      load->models.erase(path);
+  }
+}
+
+void DevicePlacement::record_latency(const c10::Device &device,
+                                     double microseconds) {
+  for (const auto &load : m_devices) {
+    if (load->device != device)
+      continue;
+    // CONCURRENT UPDATES MAY DROP A SAMPLE, WHICH DOES NOT MATTER FOR AN
+    // AVERAGE
+    auto latency = load->latency.load(std::memory_order_relaxed);
+    load->latency.store(
+        latency > 0 ? latency + latency_smoothing * (microseconds - latency)
+                    : microseconds,
+        std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <c10/core/Device.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// SLOT OF AN INSTANCE ON A DEVICE, GIVEN BACK ON DESTRUCTION
+struct DeviceLease {
+  c10::Device device;
+  std::string path;
+  ~DeviceLease();
+};
+
+// Placement of the instances using the "auto" device. Candidates are every
+// cuda device and mps, or the cpu alone when there is no accelerator. A new
+// instance goes to the device with the lowest expected cost, the mean latency
+// of the calls measured on that device times the number of instances it
+// would then run. Batched instances join the device already running their
+// model, so that their batch group stays whole, and batch groups of other
+// models are spread the same way. Each device holds one copy of the weights
+// of the models placed on it (see ModelRegistry).
+class DevicePlacement {
+public:
+  static DevicePlacement &get();
+  std::vector<c10::Device> get_devices();
+  std::shared_ptr<DeviceLease> acquire(const std::string &path, bool batching);
+  void release(const c10::Device &device, const std::string &path);
+  // DURATION OF A MODEL CALL ON device, LOCK FREE (SAFE FROM THE AUDIO THREAD)
+  void record_latency(const c10::Device &device, double microseconds);
+
+protected:
+  DevicePlacement();
+
+  struct DeviceLoad {
+    c10::Device device;
+    std::atomic<double> latency{0}; // exponential moving average
+    int instances = 0;
+    std::map<std::string, int> models; // instances per model path
+    explicit DeviceLoad(c10::Device d) : device(d) {}
+  };
+  std::mutex m_mutex; // guards the instance counts, devices never change
+  std::vector<std::unique_ptr<DeviceLoad>> m_devices;
+};
@@ -0,0 +1,88 @@
+#include "dsp_utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Both kernels are written as plain contiguous loops without aliasing so that
+// they are auto-vectorized in release builds.
+
+void expand_hold(const float *__restrict in, float *__restrict out,
+                 int n_frames, int ratio) {
+  if (ratio == 1) {
+    memcpy(out, in, n_frames * sizeof(float));
+    return;
+  }
+  for (int i(0); i < n_frames; i++) {
+    std::fill_n(out, ratio, in[i]);
+    out += ratio;
+  }
+}
+
+void expand_linear(const float *__restrict in, float *__restrict out,
+                   int n_frames, int ratio, float &history) {
+  if (!n_frames)
+    return;
+  if (ratio == 1) {
+    memcpy(out, in, n_frames * sizeof(float));
+    history = in[n_frames - 1];
+    return;
+  }
+  const float inv_ratio = 1.f / float(ratio);
+  float previous = history;
+  for (int i(0); i < n_frames; i++) {
+    const float step = (in[i] - previous) * inv_ratio;
+    for (int j(0); j < ratio; j++)
+      out[j] = previous + step * float(j + 1);
+    out += ratio;
+    previous = in[i];
+  }
+  history = previous;
+}
+
+void decimate_last(const float *__restrict in, float *__restrict out,
+                   int n_frames, int ratio) {
+  if (ratio == 1) {
+    memcpy(out, in, n_frames * sizeof(float));
+    return;
+  }
+  for (int i(0); i < n_frames; i++)
+    out[i] = in[(i + 1) * ratio - 1];
+}
+
+void decimate_mean(const float *__restrict in, float *__restrict out,
+                   int n_frames, int ratio) {
+  if (ratio == 1) {
+    memcpy(out, in, n_frames * sizeof(float));
+    return;
+  }
+  // FOUR INDEPENDENT ACCUMULATORS, SO THAT THE REDUCTION IS VECTORIZED
+  // WITHOUT REASSOCIATING FLOATING POINT ADDITIONS
+  const float inv_ratio = 1.f / float(ratio);
+  for (int i(0); i < n_frames; i++, in += ratio) {
+    float acc[4] = {0.f, 0.f, 0.f, 0.f};
+    int j(0);
+    for (; j + 4 <= ratio; j += 4) {
+      acc[0] += in[j];
+      acc[1] += in[j + 1];
+      acc[2] += in[j + 2];
+      acc[3] += in[j + 3];
+    }
+    for (; j < ratio; j++)
+      acc[0] += in[j];
+    out[i] = (acc[0] + acc[1] + acc[2] + acc[3]) * inv_ratio;
+  }
+}
+
+float peak_amplitude(const float *in, int n) {
+  float acc[4] = {0.f, 0.f, 0.f, 0.f};
+  int i(0);
+  for (; i + 4 <= n; i += 4) {
+    acc[0] = std::max(acc[0], std::abs(in[i]));
+    acc[1] = std::max(acc[1], std::abs(in[i + 1]));
+    acc[2] = std::max(acc[2], std::abs(in[i + 2]));
+    acc[3] = std::max(acc[3], std::abs(in[i + 3]));
+  }
+  for (; i < n; i++)
+    acc[0] = std::max(acc[0], std::abs(in[i]));
+  return std::max(std::max(acc[0], acc[1]), std::max(acc[2], acc[3]));
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// SAMPLE AND HOLD EXPANSION OF n_frames VALUES BY A FACTOR ratio
+void expand_hold(const float *in, float *out, int n_frames, int ratio);
+
+// LINEAR EXPANSION OF n_frames VALUES BY A FACTOR ratio. EACH FRAME RAMPS
+// FROM THE PREVIOUS ONE, STARTING FROM (AND UPDATING) history
+void expand_linear(const float *in, float *out, int n_frames, int ratio,
+                   float &history);
+
+// KEEPS THE LAST OF EVERY ratio SAMPLES, PRODUCING n_frames VALUES
+void decimate_last(const float *in, float *out, int n_frames, int ratio);
+
+// AVERAGES EVERY ratio SAMPLES (BOX FILTER), PRODUCING n_frames VALUES
+void decimate_mean(const float *in, float *out, int n_frames, int ratio);
+
+// LARGEST ABSOLUTE VALUE OF n SAMPLES
+float peak_amplitude(const float *in, int n);
@@ -0,0 +1,80 @@
+#include "engine.h"
+#include "torchscript_engine.h"
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+
+struct EngineEntry {
+  std::string name;
+  std::vector<std::string> extensions;
+  EngineFactory factory;
+};
+
+static std::mutex registry_mutex;
+
+// BUILT IN ENGINES ARE LISTED HERE RATHER THAN SELF REGISTERED, STATIC
+// INITIALIZERS OF A STATIC LIBRARY ARE DROPPED BY THE LINKER
+static std::vector<EngineEntry> &get_registry() {
+  static std::vector<EngineEntry> registry = {
+      {"torchscript",
+       {".ts", ".pt", ".pth"},
+       [] { return std::make_unique<TorchScriptEngine>(); }}};
+  return registry;
+}
+
+static std::string to_lower(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return value;
+}
+
+static bool has_extension(const std::string &path,
+                          const std::string &extension) {
+  return path.size() >= extension.size() &&
+         to_lower(path.substr(path.size() - extension.size())) ==
+             to_lower(extension);
+}
+
+void register_engine(const std::string &name,
+                     const std::vector<std::string> &extensions,
+                     EngineFactory factory) {
+  std::unique_lock<std::mutex> registry_lock(registry_mutex);
+  auto &registry = get_registry();
+  auto entry = std::find_if(
+      registry.begin(), registry.end(),
+      [&name](const EngineEntry &e) { return e.name == name; });
+  if (entry != registry.end())
+    *entry = {name, extensions, factory};
+  else
+    registry.push_back({name, extensions, factory});
+}
+
+bool has_engine(const std::string &name) {
+  auto names = get_engine_names();
+  return name.empty() || name == "auto" ||
+         std::count(names.begin(), names.end(), name);
+}
+
+std::vector<std::string> get_engine_names() {
+  std::unique_lock<std::mutex> registry_lock(registry_mutex);
+  std::vector<std::string> names;
+  for (const auto &entry : get_registry())
+    names.push_back(entry.name);
+  return names;
+}
+
+std::unique_ptr<Engine> create_engine(const std::string &name,
+                                      const std::string &path) {
+  std::unique_lock<std::mutex> registry_lock(registry_mutex);
+  auto &registry = get_registry();
+  bool automatic = name.empty() || name == "auto";
+  for (const auto &entry : registry) {
+    if (!automatic && entry.name == name)
+      return entry.factory();
+    for (const auto &extension : entry.extensions) {
+      if (automatic && has_extension(path, extension))
+        return entry.factory();
+    }
+  }
+  return automatic ? registry.front().factory() : nullptr;
+}
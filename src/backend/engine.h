@@ -0,0 +1,84 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <torch/script.h>
+#include <vector>
+
+constexpr int max_float_attributes = 32;
+
+// MODEL METADATA, READ ONCE WHEN THE MODEL IS LOADED AND NEVER MODIFIED, SO
+// THAT IT IS SERVED TO THE MESSAGE THREAD WITHOUT LOCKING THE MODEL
+struct ModelMetadata {
+  std::vector<std::string> methods;           // every method of the module
+  std::vector<std::string> available_methods; // methods exposing parameters
+  std::vector<std::string> attributes, settable_attributes;
+  std::map<std::string, std::vector<int>> method_params;
+  std::map<std::string, std::vector<std::string>> input_labels, output_labels;
+  std::map<std::string, std::vector<int>> attribute_types; // setter type ids
+  // SETTABLE ATTRIBUTES TAKING A SINGLE FLOAT, INDEXED BY FLOAT ATTRIBUTE ID
+  std::vector<std::string> float_attributes;
+};
+
+// SETTINGS OF AN ENGINE, ENGINES IGNORE THE ONES THEY DO NOT SUPPORT
+struct EngineSettings {
+  c10::Device device = c10::kCPU;
+  bool force_reload = false;
+  bool shared = false; // every instance runs the same copy (batching)
+  int optimization_level = 0; // see OptimizationLevel
+  int precision = 0;          // see Precision
+};
+
+// Runs the methods of a model on behalf of the backend. The backend owns the
+// tensors, the buffering and the threading, the engine only has to expose the
+// nn~ model contract: methods with their `<method>_params` (in_dim, in_ratio,
+// out_dim, out_ratio) and labels, and attributes with their getters, setters
+// and `<attribute>_params` type ids. Tensors are [batch, channels, frames],
+// in the precision reported by get_precision, on the device of the settings.
+//
+// Apart from the attributes, an engine is not modified once loaded, a change
+// of settings gives a new engine, so that a call in flight keeps running on
+// the previous one.
+class Engine {
+public:
+  virtual ~Engine() = default;
+  // LOADS THE MODEL, THROWS ON FAILURE
+  virtual void load(const std::string &path,
+                    const EngineSettings &settings) = 0;
+  // SAME MODEL WITH OTHER SETTINGS (DEVICE, SHARING), KEEPING THE VALUES OF
+  // THE ATTRIBUTES AND THE METHOD IDS. THROWS ON FAILURE
+  virtual std::shared_ptr<Engine>
+  reconfigure(const EngineSettings &settings) = 0;
+  virtual std::shared_ptr<const ModelMetadata> get_metadata() = 0;
+  // PRECISION THE MODEL ACTUALLY RUNS IN
+  virtual int get_precision() = 0;
+  // ID OF AN AVAILABLE METHOD, -1 IF IT CANNOT BE RUN
+  virtual int get_method(const std::string &method) = 0;
+  // RUNS A METHOD, NOT REENTRANT. THROWS ON FAILURE
+  virtual at::Tensor run(int method, const at::Tensor &input) = 0;
+  virtual std::vector<c10::IValue> get_attribute(const std::string &name) = 0;
+  // CALLS THE SETTER OF AN ATTRIBUTE, THROWS ON FAILURE
+  virtual void set_attribute(const std::string &name,
+                             const std::vector<c10::IValue> &inputs) = 0;
+  // RUNS THE AVAILABLE METHODS ON ZEROS WITHOUT AFFECTING THIS ENGINE, SAFE
+  // TO CALL CONCURRENTLY WITH run
+  virtual void warm_up(int n_iterations, int n_vec, int n_batches) {}
+  // IDENTIFIES THE MODEL SHARED BY THE INSTANCES THAT MAY BE BATCHED
+  // TOGETHER, nullptr IF THE ENGINE DOES NOT SUPPORT BATCHING
+  virtual const void *get_batching_key() { return nullptr; }
+};
+
+using EngineFactory = std::function<std::unique_ptr<Engine>()>;
+
+// REGISTERS AN ENGINE, ALSO SELECTED AUTOMATICALLY FOR THE MODEL FILES ENDING
+// WITH ONE OF THE EXTENSIONS (E.G. ".onnx"). "torchscript" IS BUILT IN.
+void register_engine(const std::string &name,
+                     const std::vector<std::string> &extensions,
+                     EngineFactory factory);
+bool has_engine(const std::string &name);
+std::vector<std::string> get_engine_names();
+// CREATES THE ENGINE NAMED `name`, OR THE ONE MATCHING THE EXTENSION OF `path`
+// IF THE NAME IS EMPTY OR "auto" (TORCHSCRIPT BY DEFAULT). nullptr IF UNKNOWN
+std::unique_ptr<Engine> create_engine(const std::string &name,
+                                      const std::string &path);
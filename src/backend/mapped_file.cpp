@@ -0,0 +1,115 @@
+#include "mapped_file.h"
+#include <algorithm>
+#include <caffe2/serialize/read_adapter_interface.h>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// READ-ONLY MAPPING OF A WHOLE FILE, UNMAPPED ON DELETION. RECORDS ARE COPIED
+// OUT OF IT BY THE DESERIALIZER
+class MappedFile : public caffe2::serialize::ReadAdapterInterface {
+public:
+  static std::unique_ptr<MappedFile> open(const std::string &path);
+  ~MappedFile() override;
+
+  size_t size() const override { return m_size; }
+  size_t read(uint64_t pos, void *buf, size_t n,
+              const char *what = "") const override {
+    if (pos >= m_size)
+      return 0;
+    n = std::min(n, size_t(m_size - pos));
+    memcpy(buf, m_data + pos, n);
+    return n;
+  }
+
+protected:
+  MappedFile() = default;
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+#if defined(_WIN32)
+  HANDLE m_file = INVALID_HANDLE_VALUE, m_mapping = nullptr;
+#endif
+};
+
+#if defined(_WIN32)
+std::unique_ptr<MappedFile> MappedFile::open(const std::string &path) {
+  std::unique_ptr<MappedFile> file(new MappedFile());
+  file->m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                             nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                             nullptr);
+  if (file->m_file == INVALID_HANDLE_VALUE)
+    return nullptr;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file->m_file, &size) || !size.QuadPart)
+    return nullptr;
+  file->m_size = size.QuadPart;
+  file->m_mapping =
+      CreateFileMappingA(file->m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!file->m_mapping)
+    return nullptr;
+  file->m_data = static_cast<const char *>(
+      MapViewOfFile(file->m_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!file->m_data)
+    return nullptr;
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  if (m_data)
+    UnmapViewOfFile(m_data);
+  if (m_mapping)
+    CloseHandle(m_mapping);
+  if (m_file != INVALID_HANDLE_VALUE)
+    CloseHandle(m_file);
+}
+#else
+std::unique_ptr<MappedFile> MappedFile::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat status;
+  if (fstat(fd, &status) || status.st_size <= 0) {
+    close(fd);
+    return nullptr;
+  }
+  auto data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // THE MAPPING STAYS VALID ONCE THE DESCRIPTOR IS CLOSED
+  close(fd);
+  if (data == MAP_FAILED)
+    return nullptr;
+  std::unique_ptr<MappedFile> file(new MappedFile());
+  file->m_data = static_cast<const char *>(data);
+  file->m_size = status.st_size;
+  return file;
+}
+
+MappedFile::~MappedFile() {
+  if (m_data)
+    munmap(const_cast<char *>(m_data), m_size);
+}
+#endif
+
+torch::jit::script::Module
+load_mapped_model(const std::string &path, c10::optional<c10::Device> device,
+                  torch::jit::ExtraFilesMap *extra_files) {
+  torch::jit::ExtraFilesMap no_extra_files;
+  if (!extra_files)
+    extra_files = &no_extra_files;
+  std::shared_ptr<MappedFile> file = MappedFile::open(path);
+  if (!file) {
+    std::cerr << "could not map " << path << ", reading it instead"
+              << std::endl;
+    return torch::jit::load(path, device, *extra_files);
+  }
+  return torch::jit::load(file, device, *extra_files);
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <torch/script.h>
+
+// Loads a TorchScript archive through a read-only memory mapping of the file
+// instead of buffered reads. This only saves the copy of the read system
+// calls: the deserializer still copies every tensor record into its own heap
+// storage, so the weights are neither backed by the mapping nor shared
+// between processes (within a process, ModelRegistry shares them). Falls back
+// to torch::jit::load if the file cannot be mapped. Throws like torch::jit::load on invalid archives. The
+// tensors (constants of frozen models included) are loaded on `device`, and
+// the extra files requested in `extra_files` are read from the archive.
+torch::jit::script::Module
+load_mapped_model(const std::string &path,
+                  c10::optional<c10::Device> device = c10::nullopt,
+                  torch::jit::ExtraFilesMap *extra_files = nullptr);
@@ -0,0 +1,124 @@
+#include "model_cache.h"
+#include "mapped_file.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <torch/version.h>
+#include <vector>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static std::atomic<bool> cache_enabled{true};
+
+void use_model_cache(bool value) { cache_enabled = value; }
+
+static fs::path cache_directory() {
+  if (auto directory = std::getenv("NN_TILDE_CACHE_DIR"))
+    return directory;
+#if defined(_WIN32)
+  if (auto directory = std::getenv("LOCALAPPDATA"))
+    return fs::path(directory) / "nn_tilde" / "cache";
+#elif defined(__APPLE__)
+  if (auto home = std::getenv("HOME"))
+    return fs::path(home) / "Library" / "Caches" / "nn_tilde";
+#else
+  if (auto directory = std::getenv("XDG_CACHE_HOME"))
+    return fs::path(directory) / "nn_tilde";
+  if (auto home = std::getenv("HOME"))
+    return fs::path(home) / ".cache" / "nn_tilde";
+#endif
+  return {};
+}
+
+// 64 BITS FNV-1A OF THE FILE CONTENT, STABLE ACROSS PLATFORMS AND BUILDS
+static bool hash_file(const std::string &path, uint64_t &hash) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  hash = 14695981039346656037ull;
+  std::vector<char> chunk(1 << 20);
+  while (file) {
+    file.read(chunk.data(), chunk.size());
+    for (std::streamsize i(0); i < file.gcount(); i++) {
+      hash ^= uint8_t(chunk[i]);
+      hash *= 1099511628211ull;
+    }
+  }
+  return true;
+}
+
+std::string model_cache_path(const std::string &model_path,
+                             const std::string &options) {
+  if (!cache_enabled)
+    return "";
+  auto directory = cache_directory();
+  uint64_t hash;
+  if (directory.empty() || !hash_file(model_path, hash))
+    return "";
+  char hash_string[17];
+  snprintf(hash_string, sizeof(hash_string), "%016llx",
+           (unsigned long long)hash);
+  auto name = fs::path(model_path).stem().string() + "-" + hash_string +
+              "-torch" + TORCH_VERSION + "-" + options + ".ts";
+  return (directory / name).string();
+}
+
+bool load_cached_model(const std::string &cache_path, c10::Device device,
+                       torch::jit::script::Module &model, int &precision) {
+  std::error_code error;
+  if (cache_path.empty() || !fs::exists(cache_path, error))
+    return false;
+  try {
+    torch::jit::ExtraFilesMap extra_files{{"nn_tilde_precision", ""}};
+    model = load_mapped_model(cache_path, device, &extra_files);
+    precision = std::stoi(extra_files["nn_tilde_precision"]);
+    model.eval();
+    return true;
+  } catch (const std::exception &e) {
+    // STALE OR CORRUPTED ENTRY, REBUILT BY THE CALLER
+    std::cerr << "ignoring cached model " << cache_path << ": " << e.what()
+              << '\n';
+    fs::remove(cache_path, error);
+    return false;
+  }
+}
+
+// UNIQUE ACROSS PROCESSES (PID) AND ACROSS THREADS (RANDOM DEVICE). std::rand
+// IS NOT SEEDED, EVERY PROCESS WOULD GET THE SAME NAMES
+static std::string temporary_suffix() {
+  std::random_device device;
+  return ".tmp" + std::to_string(getpid()) + "-" + std::to_string(device());
+}
+
+void save_cached_model(const std::string &cache_path,
+                       const torch::jit::script::Module &model, int precision) {
+  if (cache_path.empty())
+    return;
+  // WRITTEN NEXT TO THE ENTRY, THEN RENAMED, SO THAT CONCURRENT PROCESSES
+  // NEVER READ A PARTIAL FILE
+  auto temporary_path = cache_path + temporary_suffix();
+  std::error_code error;
+  try {
+    fs::create_directories(fs::path(cache_path).parent_path());
+    torch::jit::ExtraFilesMap extra_files{
+        {"nn_tilde_precision", std::to_string(precision)}};
+    model.save(temporary_path, extra_files);
+    fs::rename(temporary_path, cache_path);
+  } catch (const std::exception &e) {
+    std::cerr << "could not cache model to " << cache_path << ": " << e.what()
+              << '\n';
+    fs::remove(temporary_path, error);
+  }
+}
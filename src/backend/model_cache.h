@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <torch/script.h>
+
+// On-disk cache of specialized (frozen, optimized, converted) models, so that
+// the load time passes only run the first time a configuration is used. The
+// entries live in $NN_TILDE_CACHE_DIR, or in the user cache directory of the
+// platform, and are keyed by the hash of the source archive, the libtorch
+// version and the load options.
+
+// ENABLES / DISABLES THE CACHE FOR THE WHOLE PROCESS (ENABLED BY DEFAULT)
+void use_model_cache(bool value);
+
+// PATH OF THE ENTRY OF A MODEL FOR THE GIVEN OPTIONS, EMPTY IF THE CACHE IS
+// DISABLED OR UNAVAILABLE
+std::string model_cache_path(const std::string &model_path,
+                             const std::string &options);
+
+// RETURNS FALSE IF THERE IS NO (VALID) ENTRY. THE MODEL IS LOADED ON device,
+// precision IS SET TO THE ONE STORED WITH THE ENTRY.
+bool load_cached_model(const std::string &cache_path, c10::Device device,
+                       torch::jit::script::Module &model, int &precision);
+
+// WRITES THE ENTRY ATOMICALLY, FAILURES ARE REPORTED BUT NOT FATAL
+void save_cached_model(const std::string &cache_path,
+                       const torch::jit::script::Module &model, int precision);
@@ -0,0 +1,308 @@
+#include "model_registry.h"
+#include "mapped_file.h"
+#include "model_cache.h"
+#include <algorithm>
+#include <iostream>
+
+ModelRegistry &ModelRegistry::get() {
+  static ModelRegistry registry;
+  return registry;
+}
+
+std::shared_ptr<torch::jit::script::Module>
+ModelRegistry::acquire(const std::string &path, c10::Device device,
+                       bool force_reload, int optimization_level,
+                       int precision, int *effective_precision) {
+  auto key = path + "@" + device.str() + "#" +
+             std::to_string(optimization_level) + ":" +
+             precision_name(precision);
+  std::unique_lock<std::mutex> registry_lock(m_mutex);
+
+  // FORGET MODELS THAT ARE NOT USED ANYMORE
+  for (auto it = m_models.begin(); it != m_models.end();) {
+    if (it->second.model.expired())
+      it = m_models.erase(it);
+    else
+      it++;
+  }
+
+  if (!force_reload) {
+    auto entry = m_models.find(key);
+    if (entry != m_models.end()) {
+      if (auto model = entry->second.model.lock()) {
+        if (effective_precision)
+          *effective_precision = entry->second.precision;
+        return model;
+      }
+    }
+    // ANOTHER INSTANCE IS LOADING THE SAME MODEL, ITS RESULT IS SHARED
+    auto loading = m_loading.find(key);
+    if (loading != m_loading.end()) {
+      auto result = loading->second.result;
+      registry_lock.unlock();
+      auto loaded = result.get(); // THROWS IF THAT LOAD FAILED
+      if (effective_precision)
+        *effective_precision = loaded.precision;
+      return loaded.model;
+    }
+  }
+
+  // THE LOAD ITSELF RUNS WITHOUT THE LOCK, LOADS OF OTHER MODELS GO ON
+  std::promise<Loaded> promise;
+  auto ticket = m_next_ticket++;
+  m_loading[key] = {promise.get_future().share(), ticket};
+  registry_lock.unlock();
+
+  Loaded loaded;
+  try {
+    loaded = load(path, device, optimization_level, precision);
+  } catch (...) {
+    registry_lock.lock();
+    if (m_loading.count(key) && m_loading[key].ticket == ticket)
+      m_loading.erase(key);
+    registry_lock.unlock();
+    promise.set_exception(std::current_exception());
+    throw;
+  }
+
+  registry_lock.lock();
+  // A FORCED RELOAD STARTED IN THE MEANTIME IS THE ONE KEPT
+  if (m_loading.count(key) && m_loading[key].ticket == ticket) {
+    m_models[key] = {loaded.model, loaded.precision};
+    m_loading.erase(key);
+  }
+  registry_lock.unlock();
+  promise.set_value(loaded);
+
+  if (effective_precision)
+    *effective_precision = loaded.precision;
+  return loaded.model;
+}
+
+ModelRegistry::Loaded ModelRegistry::load(const std::string &path,
+                                          c10::Device device,
+                                          int optimization_level,
+                                          int precision) {
+  // INSTANCES STILL USING A PREVIOUS VERSION KEEP IT UNTIL THEY RELOAD
+  auto model = std::make_shared<torch::jit::script::Module>();
+  int converted_precision = PRECISION_FP32;
+
+  // SPECIALIZED MODELS ARE KEPT ON DISK, KEYED BY THE CONTENT OF THE ARCHIVE
+  // (AND MAPPED TO ANY DEVICE OF THE SAME TYPE)
+  std::string cache_path;
+  if (optimization_level > OPTIMIZE_NONE || precision != PRECISION_FP32)
+    cache_path = model_cache_path(
+        path, c10::DeviceTypeName(device.type(), true) + "-o" +
+                  std::to_string(optimization_level) + "-" +
+                  precision_name(precision));
+
+  if (!load_cached_model(cache_path, device, *model, converted_precision)) {
+    // THE ARCHIVE IS READ THROUGH A MAPPING OF THE FILE
+    *model = load_mapped_model(path);
+    model->eval();
+    model->to(device);
+    // WEIGHTS ARE CONVERTED BEFORE FREEZING, SO THAT THEY ARE FOLDED AS IS
+    converted_precision = convert_model_precision(*model, device, precision);
+    if (optimization_level > OPTIMIZE_NONE)
+      *model = optimize_model(*model, optimization_level);
+    save_cached_model(cache_path, *model, converted_precision);
+  }
+  return {model, converted_precision};
+}
+
+int precision_from_string(const std::string &name) {
+  for (int precision(PRECISION_FP32); precision <= PRECISION_INT8; precision++)
+    if (name == precision_name(precision))
+      return precision;
+  return -1;
+}
+
+std::string precision_name(int precision) {
+  switch (precision) {
+  case PRECISION_FP16:
+    return "fp16";
+  case PRECISION_BF16:
+    return "bf16";
+  case PRECISION_INT8:
+    return "int8";
+  default:
+    return "fp32";
+  }
+}
+
+at::ScalarType precision_dtype(int precision) {
+  switch (precision) {
+  case PRECISION_FP16:
+    return torch::kFloat16;
+  case PRECISION_BF16:
+    return torch::kBFloat16;
+  default: // QUANTIZED LAYERS TAKE AND RETURN FLOAT32 TENSORS
+    return torch::kFloat32;
+  }
+}
+
+static bool has_quantized_layers(const torch::jit::script::Module &model) {
+  for (const auto &module : model.modules())
+    for (const auto &method : module.get_methods())
+      if (method.graph()->toString().find("quantized::") != std::string::npos)
+        return true;
+  return false;
+}
+
+static bool select_quantized_engine() {
+  auto engines = at::globalContext().supportedQEngines();
+  auto supports = [&](at::QEngine engine) {
+    return std::find(engines.begin(), engines.end(), engine) != engines.end();
+  };
+#if defined(__aarch64__) || defined(__arm__)
+  auto preferred = at::QEngine::QNNPACK;
+#else
+  auto preferred = at::QEngine::FBGEMM;
+#endif
+  if (supports(preferred))
+    at::globalContext().setQEngine(preferred);
+  else if (supports(at::QEngine::QNNPACK))
+    at::globalContext().setQEngine(at::QEngine::QNNPACK);
+  else
+    return false;
+  return true;
+}
+
+// RUNS EVERY METHOD EXPOSING PARAMETERS ON A SHORT BUFFER OF ZEROS
+static bool check_model_precision(torch::jit::script::Module &model,
+                                  c10::Device device, int precision) {
+  c10::InferenceMode guard;
+  auto options =
+      torch::TensorOptions().dtype(precision_dtype(precision)).device(device);
+  for (const auto &method : model.get_methods()) {
+    if (!model.hasattr(method.name() + "_params"))
+      continue;
+    try {
+      auto p =
+          model.attr(method.name() + "_params").toTensor().to(torch::kCPU);
+      auto in_dim = p[0].item().to<int>();
+      auto in_ratio = p[1].item().to<int>();
+      auto n_frames = std::max(2048 / in_ratio, 1);
+      method({torch::zeros({1, in_dim, n_frames}, options)});
+    } catch (const std::exception &e) {
+      std::cerr << "method " << method.name() << " does not support "
+                << precision_name(precision) << ": " << e.what() << '\n';
+      return false;
+    }
+  }
+  return true;
+}
+
+int convert_model_precision(torch::jit::script::Module &model,
+                            c10::Device device, int precision) {
+  // LAYERS QUANTIZED BEFORE EXPORT RUN IN INT8 WHATEVER THE REQUESTED
+  // PRECISION, THEIR WEIGHTS CANNOT BE CONVERTED
+  if (has_quantized_layers(model)) {
+    if (!device.is_cpu()) {
+      std::cerr << "quantized layers only run on cpu" << std::endl;
+      return PRECISION_FP32;
+    }
+    if (!select_quantized_engine()) {
+      std::cerr << "no quantized engine available" << std::endl;
+      return PRECISION_FP32;
+    }
+    if (precision != PRECISION_FP32)
+      std::cerr << "model is quantized, using int8 instead of "
+                << precision_name(precision) << std::endl;
+    return PRECISION_INT8;
+  }
+
+  if (precision == PRECISION_FP32)
+    return PRECISION_FP32;
+
+  // CONVERT A COPY, SO THAT A FAILED CONVERSION KEEPS THE ORIGINAL WEIGHTS.
+  // THE CHECK RUNS ON AN INSTANCE, LEAVING THE BUFFERS OF THE COPY UNTOUCHED.
+  auto converted = model.clone();
+  converted.to(precision_dtype(precision));
+  auto instance = instantiate_shared_model(converted);
+  if (!check_model_precision(instance, device, precision)) {
+    std::cerr << "using fp32 instead of " << precision_name(precision)
+              << std::endl;
+    return PRECISION_FP32;
+  }
+  model = converted;
+  return precision;
+}
+
+static bool is_module_slot(const c10::ClassTypePtr &type, size_t slot) {
+  auto class_type = type->getAttribute(slot)->cast<c10::ClassType>();
+  return class_type && class_type->is_module();
+}
+
+static c10::intrusive_ptr<c10::ivalue::Object>
+instantiate_object(const c10::intrusive_ptr<c10::ivalue::Object> &object) {
+  auto instance = object->copy();
+  auto type = object->type();
+  for (size_t i = 0; i < type->numAttributes(); i++) {
+    auto slot = instance->getSlot(i);
+    if (slot.isObject() && is_module_slot(type, i)) {
+      instance->setSlot(i, instantiate_object(slot.toObject()));
+    } else if (slot.isTensor() && !type->is_parameter(i)) {
+      instance->setSlot(i, slot.toTensor().clone());
+    }
+  }
+  return instance;
+}
+
+torch::jit::script::Module
+optimize_model(const torch::jit::script::Module &model,
+               int optimization_level) {
+  std::vector<std::string> preserved, methods;
+  for (const auto &method : model.get_methods()) {
+    preserved.push_back(method.name());
+    if (method.name() != "forward")
+      methods.push_back(method.name());
+  }
+
+  // ATTRIBUTES ARE READ BY NAME FROM THE BACKEND, ONLY SUBMODULES AND
+  // PARAMETERS ARE FOLDED INTO THE GRAPHS
+  auto type = model.type();
+  for (size_t i = 0; i < type->numAttributes(); i++) {
+    auto name = type->getAttributeName(i);
+    if (!is_module_slot(type, i) && !type->is_parameter(i) &&
+        name != "training")
+      preserved.push_back(name);
+  }
+
+  try {
+    auto frozen = torch::jit::freeze(model, preserved);
+    if (optimization_level >= OPTIMIZE_INFERENCE)
+      frozen = torch::jit::optimize_for_inference(frozen, methods);
+    return frozen;
+  } catch (const std::exception &e) {
+    std::cerr << "could not optimize model, using it as is: " << e.what()
+              << '\n';
+    return model;
+  }
+}
+
+torch::jit::script::Module
+instantiate_shared_model(const torch::jit::script::Module &model) {
+  return torch::jit::script::Module(instantiate_object(model._ivalue()));
+}
+
+static void
+copy_object_attributes(const c10::intrusive_ptr<c10::ivalue::Object> &source,
+                       const c10::intrusive_ptr<c10::ivalue::Object> &target) {
+  auto type = source->type();
+  if (type != target->type())
+    return;
+  for (size_t i = 0; i < type->numAttributes(); i++) {
+    auto slot = source->getSlot(i);
+    if (slot.isObject() && is_module_slot(type, i)) {
+      copy_object_attributes(slot.toObject(), target->getSlot(i).toObject());
+    } else if (!slot.isTensor()) {
+      target->setSlot(i, slot);
+    }
+  }
+}
+
+void copy_model_attributes(const torch::jit::script::Module &source,
+                           torch::jit::script::Module &target) {
+  copy_object_attributes(source._ivalue(), target._ivalue());
+}
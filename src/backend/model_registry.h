@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <torch/script.h>
+
+// LOAD TIME GRAPH OPTIMIZATIONS
+enum OptimizationLevel {
+  OPTIMIZE_NONE = 0,
+  OPTIMIZE_FREEZE = 1,    // torch::jit::freeze
+  OPTIMIZE_INFERENCE = 2, // freeze + torch::jit::optimize_for_inference
+};
+
+// NUMERICAL PRECISION OF THE WEIGHTS, INPUTS AND OUTPUTS STAY IN FLOAT32
+enum Precision {
+  PRECISION_FP32 = 0,
+  PRECISION_FP16 = 1,
+  PRECISION_BF16 = 2,
+  PRECISION_INT8 = 3, // quantized before export, cpu only, never requested
+};
+
+// "fp32", "fp16", "bf16" or "int8", -1 if unknown
+int precision_from_string(const std::string &name);
+std::string precision_name(int precision);
+// FLOATING POINT TYPE OF THE TENSORS GIVEN TO A MODEL OF THAT PRECISION
+at::ScalarType precision_dtype(int precision);
+
+// PROCESS-WIDE CACHE OF LOADED MODELS, KEYED BY PATH, DEVICE (INCLUDING ITS
+// INDEX, ONE COPY OF THE WEIGHTS PER DEVICE), OPTIMIZATION LEVEL AND
+// PRECISION. MODELS ARE REFERENCE COUNTED AND RELEASED ONCE THE LAST INSTANCE
+// USING THEM IS GONE. MODELS THAT CANNOT RUN IN THE REQUESTED
+// PRECISION ARE KEPT IN FLOAT32, THE PRECISION ACTUALLY USED IS WRITTEN TO
+// `effective_precision`. MODELS ARE LOADED WITHOUT HOLDING THE REGISTRY LOCK,
+// CONCURRENT REQUESTS FOR A MODEL BEING LOADED WAIT FOR THAT LOAD.
+class ModelRegistry {
+public:
+  static ModelRegistry &get();
+  std::shared_ptr<torch::jit::script::Module>
+  acquire(const std::string &path, c10::Device device,
+          bool force_reload = false, int optimization_level = OPTIMIZE_NONE,
+          int precision = PRECISION_FP32, int *effective_precision = nullptr);
+
+protected:
+  struct Entry {
+    std::weak_ptr<torch::jit::script::Module> model;
+    int precision;
+  };
+  struct Loaded {
+    std::shared_ptr<torch::jit::script::Module> model;
+    int precision;
+  };
+  struct Loading {
+    std::shared_future<Loaded> result;
+    uint64_t ticket; // TELLS A FORCED RELOAD FROM THE LOAD IT REPLACED
+  };
+  static Loaded load(const std::string &path, c10::Device device,
+                     int optimization_level, int precision);
+
+  std::mutex m_mutex;
+  std::map<std::string, Entry> m_models;
+  std::map<std::string, Loading> m_loading; // LOADS IN FLIGHT
+  uint64_t m_next_ticket = 0;
+};
+
+// Creates an instance of a shared model. Parameters (the weights) are shared
+// with the original module, while attributes and buffers are owned by the
+// instance, so that setters and stateful buffers (e.g. cached convolutions)
+// do not leak between nn~ objects.
+torch::jit::script::Module
+instantiate_shared_model(const torch::jit::script::Module &model);
+
+// Freezes the model (inlining parameters and constant attributes in the
+// graphs) and optionally applies the inference optimization passes. Every
+// method, as well as the attributes read by the backend (method parameters,
+// labels, settings), are preserved. Returns the original model on failure.
+torch::jit::script::Module
+optimize_model(const torch::jit::script::Module &model,
+               int optimization_level);
+
+// Converts the weights and buffers of the model to the given precision, and
+// checks that every method exposing parameters still runs. Models containing
+// dynamically quantized layers (libtorch cannot quantize a scripted model
+// itself) are left as is and run in int8 on the quantized engine of the
+// platform. Returns the precision of the model, PRECISION_FP32 on failure.
+int convert_model_precision(torch::jit::script::Module &model,
+                            c10::Device device, int precision);
+
+// Copies non tensor attributes (i.e. the model settings) between two
+// instances of the same model
+void copy_model_attributes(const torch::jit::script::Module &source,
+                           torch::jit::script::Module &target);
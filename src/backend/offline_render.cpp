@@ -0,0 +1,155 @@
+#include "offline_render.h"
+#include <algorithm>
+#include <iostream>
+
+OfflineRenderer::~OfflineRenderer() {
+  cancel();
+  if (m_future.valid())
+    m_future.wait();
+}
+
+int OfflineRenderer::start(Backend &source, std::string method,
+                           std::vector<std::vector<float>> inputs,
+                           int chunk_size, int n_batches,
+                           bool linear_interpolation, bool input_averaging) {
+  if (m_running.exchange(true)) {
+    std::cerr << "a render is already running" << std::endl;
+    return 1;
+  }
+  auto params = source.get_method_params(method);
+  if (!params.size() || !inputs.size() || chunk_size <= 0 || n_batches <= 0) {
+    std::cerr << "invalid render arguments" << std::endl;
+    m_running = false;
+    return 1;
+  }
+  if (m_future.valid())
+    m_future.wait();
+
+  // SETTINGS OF THE LIVE MODEL, KEPT AS TYPED VALUES
+  AttributeValues attributes;
+  for (const auto &attribute : source.get_settable_attributes()) {
+    try {
+      attributes[attribute] = source.get_attribute(attribute);
+    } catch (...) {
+    }
+  }
+
+  auto path = source.get_path();
+  auto device = source.get_device();
+  m_inputs = std::move(inputs);
+  m_outputs.clear();
+  m_progress = 0;
+  m_cancel = false;
+  m_future = std::async(std::launch::async, [this, path, device, attributes,
+                                             method, chunk_size, n_batches,
+                                             linear_interpolation,
+                                             input_averaging] {
+    auto return_code =
+        render(path, device, attributes, method, chunk_size, n_batches,
+               linear_interpolation, input_averaging);
+    m_running = false;
+    return return_code;
+  });
+  return 0;
+}
+
+void OfflineRenderer::cancel() { m_cancel = true; }
+
+bool OfflineRenderer::is_running() { return m_running; }
+
+float OfflineRenderer::get_progress() { return m_progress; }
+
+int OfflineRenderer::get_result(std::vector<std::vector<float>> &outputs) {
+  if (m_running || !m_future.valid())
+    return 1;
+  if (m_future.get())
+    return 1;
+  outputs = std::move(m_outputs);
+  return 0;
+}
+
+int OfflineRenderer::render(std::string path, std::string device,
+                            AttributeValues attributes, std::string method,
+                            int chunk_size, int n_batches,
+                            bool linear_interpolation, bool input_averaging) {
+  Backend backend;
+  // THE DEVICE THE LIVE MODEL RUNS ON, "auto" AND "gpu" ALREADY RESOLVED
+  if (backend.set_device(device))
+    return 1;
+  backend.use_linear_interpolation(linear_interpolation);
+  backend.use_input_averaging(input_averaging);
+  if (backend.load(path))
+    return 1;
+
+  for (const auto &[name, values] : attributes) {
+    try {
+      backend.set_attribute(name, values);
+    } catch (...) {
+    }
+  }
+  backend.apply_attribute_commands();
+
+  auto params = backend.get_method_params(method);
+  if (!params.size())
+    return 1;
+  auto in_dim = params[0], out_dim = params[2];
+
+  // CHUNKS ARE ROUNDED UP TO THE MODEL RATIO, SEGMENTS TO THE CHUNK SIZE
+  auto ratio = backend.get_higher_ratio();
+  chunk_size = std::max(1, (chunk_size + ratio - 1) / ratio) * ratio;
+  int n_samples = 0;
+  for (const auto &input : m_inputs)
+    n_samples = std::max(n_samples, int(input.size()));
+  int n_chunks = (n_samples + n_batches * chunk_size - 1) /
+                 (n_batches * chunk_size);
+  int segment_size = n_chunks * chunk_size;
+
+  // CHANNEL MAJOR INPUTS AND BATCH MAJOR OUTPUTS, AS IN Backend::perform
+  std::vector<std::vector<float>> in_chunks(
+      in_dim * n_batches, std::vector<float>(chunk_size));
+  std::vector<std::vector<float>> out_chunks(
+      out_dim * n_batches, std::vector<float>(chunk_size));
+  std::vector<float *> in_buffer, out_buffer;
+  for (auto &chunk : in_chunks)
+    in_buffer.push_back(chunk.data());
+  for (auto &chunk : out_chunks)
+    out_buffer.push_back(chunk.data());
+
+  std::vector<std::vector<float>> outputs(
+      out_dim, std::vector<float>(n_samples, 0.f));
+
+  for (int k(0); k < n_chunks; k++) {
+    if (m_cancel)
+      return 1;
+
+    for (int d(0); d < in_dim; d++) {
+      for (int b(0); b < n_batches; b++) {
+        auto &chunk = in_chunks[d * n_batches + b];
+        std::fill(chunk.begin(), chunk.end(), 0.f);
+        if (d >= m_inputs.size())
+          continue;
+        auto &input = m_inputs[d];
+        int start = b * segment_size + k * chunk_size;
+        int n = std::clamp(int(input.size()) - start, 0, chunk_size);
+        std::copy_n(input.begin() + std::min(start, int(input.size())), n,
+                    chunk.begin());
+      }
+    }
+
+    backend.perform(in_buffer, out_buffer, chunk_size, method, n_batches);
+
+    for (int d(0); d < out_dim; d++) {
+      for (int b(0); b < n_batches; b++) {
+        auto &chunk = out_chunks[b * out_dim + d];
+        int start = b * segment_size + k * chunk_size;
+        int n = std::clamp(n_samples - start, 0, chunk_size);
+        std::copy_n(chunk.begin(), n,
+                    outputs[d].begin() + std::min(start, n_samples));
+      }
+    }
+    m_progress = float(k + 1) / n_chunks;
+  }
+
+  m_outputs = std::move(outputs);
+  return 0;
+}
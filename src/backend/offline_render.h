@@ -0,0 +1,40 @@
+#pragma once
+#include "backend.h"
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+
+// Renders whole signals through a method of a model, outside of the real-time
+// chain. The signal is split into `n_batches` contiguous segments, processed
+// in parallel as the batches of the model, `chunk_size` samples at a time.
+// Rendering happens in a background thread, on a private instance of the
+// model (sharing its weights with the live one, placed on the same device
+// and initialized with its attribute values), so that the real-time
+// processing is left untouched.
+class OfflineRenderer {
+public:
+  ~OfflineRenderer(); // cancels and joins a running render
+
+  // RETURNS 1 IF A RENDER IS ALREADY RUNNING OR IF THE ARGUMENTS ARE INVALID
+  int start(Backend &source, std::string method,
+            std::vector<std::vector<float>> inputs, int chunk_size,
+            int n_batches, bool linear_interpolation, bool input_averaging);
+  void cancel();
+  bool is_running();
+  float get_progress(); // between 0 and 1
+
+  // ONCE THE RENDER IS OVER, RETURNS 0 AND MOVES THE RESULT (ONE VECTOR PER
+  // MODEL OUTPUT) ON SUCCESS, 1 ON FAILURE OR CANCELLATION
+  int get_result(std::vector<std::vector<float>> &outputs);
+
+protected:
+  int render(std::string path, std::string device,
+             AttributeValues attributes, std::string method, int chunk_size,
+             int n_batches, bool linear_interpolation, bool input_averaging);
+
+  std::vector<std::vector<float>> m_inputs, m_outputs;
+  std::atomic<float> m_progress{0};
+  std::atomic<bool> m_cancel{false}, m_running{false};
+  std::future<int> m_future;
+};
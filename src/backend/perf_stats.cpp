@@ -0,0 +1,117 @@
+#include "perf_stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+const char *perf_stage_name(int stage) {
+  switch (stage) {
+  case STAGE_INPUT:
+    return "input";
+  case STAGE_FORWARD:
+    return "forward";
+  case STAGE_OUTPUT:
+    return "output";
+  case STAGE_TOTAL:
+    return "total";
+  default:
+    return "unknown";
+  }
+}
+
+void LatencyHistogram::record(double microseconds) {
+  int bucket = 0;
+  if (microseconds > 1)
+    bucket = std::min(int(4 * std::log2(microseconds)), n_buckets - 1);
+  m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::percentile(double p) {
+  uint64_t total = 0;
+  for (auto &bucket : m_buckets)
+    total += bucket.load(std::memory_order_relaxed);
+  if (!total)
+    return 0;
+
+  auto rank = uint64_t(std::ceil(p * total));
+  uint64_t accumulated = 0;
+  for (int i(0); i < n_buckets; i++) {
+    accumulated += m_buckets[i].load(std::memory_order_relaxed);
+    if (accumulated >= rank)
+      return std::exp2((i + 1) / 4.);
+  }
+  return std::exp2(n_buckets / 4.);
+}
+
+void LatencyHistogram::reset() {
+  for (auto &bucket : m_buckets)
+    bucket.store(0, std::memory_order_relaxed);
+  m_count.store(0, std::memory_order_relaxed);
+}
+
+void PerfStats::record(PerfStage stage, double microseconds) {
+  m_stages[stage].record(microseconds);
+}
+
+void PerfStats::record_deadline_miss() {
+  m_deadline_misses.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PerfStats::record_queue_depth(int depth) {
+  m_queue_depth_sum.fetch_add(depth, std::memory_order_relaxed);
+  m_queue_depth_count.fetch_add(1, std::memory_order_relaxed);
+  auto max_depth = m_max_queue_depth.load(std::memory_order_relaxed);
+  while (depth > max_depth &&
+         !m_max_queue_depth.compare_exchange_weak(max_depth, depth,
+                                                  std::memory_order_relaxed))
+    ;
+}
+
+void PerfStats::reset() {
+  for (auto &stage : m_stages)
+    stage.reset();
+  m_deadline_misses = 0;
+  m_max_queue_depth = 0;
+  m_queue_depth_sum = 0;
+  m_queue_depth_count = 0;
+}
+
+std::vector<StageStats> PerfStats::get_stage_stats() {
+  std::vector<StageStats> stats;
+  for (int i(0); i < N_STAGES; i++) {
+    auto &stage = m_stages[i];
+    stats.push_back({perf_stage_name(i), stage.count(), stage.percentile(.5),
+                     stage.percentile(.95), stage.percentile(.99)});
+  }
+  return stats;
+}
+
+int PerfStats::get_deadline_misses() { return m_deadline_misses; }
+
+double PerfStats::get_mean_queue_depth() {
+  auto count = m_queue_depth_count.load(std::memory_order_relaxed);
+  if (!count)
+    return 0;
+  return double(m_queue_depth_sum.load(std::memory_order_relaxed)) / count;
+}
+
+int PerfStats::get_max_queue_depth() { return m_max_queue_depth; }
+
+std::vector<std::string> PerfStats::format() {
+  std::vector<std::string> lines;
+  for (const auto &stage : get_stage_stats()) {
+    char line[128];
+    snprintf(line, sizeof(line),
+             "%s: %llu calls, p50 %.0fus, p95 %.0fus, p99 %.0fus",
+             stage.name.c_str(), (unsigned long long)stage.count, stage.p50,
+             stage.p95, stage.p99);
+    lines.push_back(line);
+  }
+  lines.push_back("deadline misses: " +
+                  std::to_string(get_deadline_misses()));
+  char line[128];
+  snprintf(line, sizeof(line), "queue depth: mean %.2f, max %d",
+           get_mean_queue_depth(), get_max_queue_depth());
+  lines.push_back(line);
+  return lines;
+}
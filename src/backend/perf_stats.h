@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// STAGES OF A MODEL CALL, TIMED BY THE BACKEND
+enum PerfStage {
+  STAGE_INPUT,   // transfer of the input to the model device
+  STAGE_FORWARD, // model method (including cross-instance batching)
+  STAGE_OUTPUT,  // transfer back to host memory and expansion
+  STAGE_TOTAL,   // whole call, including the wait for the model lock
+  N_STAGES
+};
+
+const char *perf_stage_name(int stage);
+
+// Lock-free histogram of durations. Buckets are logarithmic, four per octave
+// from 1us to about 1s, so that recording is a single relaxed increment and
+// percentiles are accurate within 20%.
+class LatencyHistogram {
+public:
+  void record(double microseconds);
+  double percentile(double p); // upper bound of the bucket, in microseconds
+  uint64_t count() { return m_count.load(std::memory_order_relaxed); }
+  void reset();
+
+protected:
+  static constexpr int n_buckets = 80;
+  std::array<std::atomic<uint64_t>, n_buckets> m_buckets{};
+  std::atomic<uint64_t> m_count{0};
+};
+
+struct StageStats {
+  std::string name;
+  uint64_t count;
+  double p50, p95, p99; // microseconds
+};
+
+// Per-instance counters, written from the audio and compute threads and read
+// from the message thread without locking.
+class PerfStats {
+public:
+  void record(PerfStage stage, double microseconds);
+  void record_deadline_miss();
+  void record_queue_depth(int depth);
+  void reset();
+
+  std::vector<StageStats> get_stage_stats();
+  int get_deadline_misses();
+  double get_mean_queue_depth();
+  int get_max_queue_depth();
+  std::vector<std::string> format(); // human readable, one line per entry
+
+protected:
+  std::array<LatencyHistogram, N_STAGES> m_stages;
+  std::atomic<int> m_deadline_misses{0};
+  std::atomic<int> m_max_queue_depth{0};
+  std::atomic<uint64_t> m_queue_depth_sum{0}, m_queue_depth_count{0};
+};
+
+// RECORDS (AND RETURNS) THE TIME ELAPSED SINCE THE LAST CALL (OR THE
+// CONSTRUCTION), IN MICROSECONDS
+class StageTimer {
+public:
+  explicit StageTimer(PerfStats &stats)
+      : m_stats(stats), m_start(std::chrono::steady_clock::now()) {}
+  double lap(PerfStage stage) {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double, std::micro> elapsed = now - m_start;
+    m_stats.record(stage, elapsed.count());
+    m_start = now;
+    return elapsed.count();
+  }
+
+protected:
+  PerfStats &m_stats;
+  std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,244 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+int physical_core_count() {
+  int count = 0;
+#if defined(__APPLE__)
+  int value = 0;
+  size_t size = sizeof(value);
+  if (!sysctlbyname("hw.physicalcpu", &value, &size, nullptr, 0))
+    count = value;
+#elif defined(__linux__)
+  std::set<std::pair<int, int>> cores;
+  for (int cpu(0);; cpu++) {
+    auto topology =
+        "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+    std::ifstream package(topology + "physical_package_id");
+    std::ifstream core(topology + "core_id");
+    int package_id, core_id;
+    if (!(package >> package_id) || !(core >> core_id))
+      break;
+    cores.insert({package_id, core_id});
+  }
+  count = cores.size();
+#endif
+  if (count <= 0)
+    count = std::thread::hardware_concurrency();
+  return std::max(count, 1);
+}
+
+static void configure_current_thread(int priority,
+                                     const std::vector<int> &affinity) {
+#if defined(_WIN32)
+  if (affinity.size()) {
+    DWORD_PTR mask = 0;
+    for (auto core : affinity)
+      mask |= DWORD_PTR(1) << core;
+    SetThreadAffinityMask(GetCurrentThread(), mask);
+  }
+  if (priority > 0)
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+#else
+#if defined(__linux__)
+  if (affinity.size()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (auto core : affinity)
+      CPU_SET(core, &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set))
+      std::cerr << "could not set compute thread affinity" << std::endl;
+  }
+#endif
+  if (priority > 0) {
+    sched_param param;
+    param.sched_priority =
+        std::min(priority, sched_get_priority_max(SCHED_FIFO));
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+      std::cerr << "could not set compute thread priority" << std::endl;
+  }
+#endif
+}
+
+ComputePool &ComputePool::get() {
+  static ComputePool pool;
+  return pool;
+}
+
+ComputePool::ComputePool()
+    : m_num_threads(std::min(physical_core_count(), max_pool_threads)),
+      m_priority(0) {
+  start();
+}
+
+ComputePool::~ComputePool() { stop(); }
+
+void ComputePool::start() {
+  m_should_stop = false;
+  int n_threads = m_num_threads;
+  for (int i(m_num_queues); i < n_threads; i++) {
+    m_queues[i] = std::make_unique<WorkerQueue>();
+    m_num_queues.store(i + 1, std::memory_order_release);
+  }
+  for (int i(0); i < n_threads; i++)
+    m_workers.emplace_back(&ComputePool::worker_loop, this, i);
+}
+
+void ComputePool::stop() {
+  {
+    std::unique_lock<std::mutex> sleep_lock(m_sleep_mutex);
+    m_should_stop = true;
+  }
+  m_sleep_condition.notify_all();
+  for (auto &worker : m_workers)
+    worker.join();
+  m_workers.clear();
+}
+
+bool ComputePool::submit(std::function<void()> job) {
+  // QUEUES BEYOND THE CURRENT NUMBER OF THREADS ARE STILL DRAINED BY THE
+  // WORKERS, SO THAT A RECONFIGURATION NEVER LOSES A JOB
+  int n_queues = std::min(m_num_threads.load(std::memory_order_relaxed),
+                          m_num_queues.load(std::memory_order_acquire));
+  auto first = m_next_queue.fetch_add(1, std::memory_order_relaxed);
+  m_pending++;
+  bool pushed = false;
+  for (int k(0); k < n_queues && !pushed; k++)
+    pushed = m_queues[(first + k) % n_queues]->jobs.push(std::move(job));
+  if (!pushed) {
+    m_pending--;
+    return false;
+  }
+  // EVERY QUEUED JOB CAN BE STOLEN, SO ONE SLEEPING WORKER IS WOKEN UP. A
+  // WORKER COUNTED AS SLEEPING EITHER SEES THE JOB IN ITS PREDICATE OR IS
+  // WAITING ONCE THE SLEEP LOCK IS TAKEN, SO THE WAKE UP CANNOT BE LOST. THE
+  // LOCK IS ONLY HELD BY WORKERS CHECKING THE PREDICATE, AND NOT TAKEN AT ALL
+  // WHILE EVERY WORKER IS BUSY
+  if (m_sleepers.load() > 0) {
+    { std::unique_lock<std::mutex> sleep_lock(m_sleep_mutex); }
+    m_sleep_condition.notify_one();
+  }
+  return true;
+}
+
+void ComputePool::configure(int num_threads, int priority,
+                            std::vector<int> affinity) {
+  std::unique_lock<std::mutex> config_lock(m_config_mutex);
+  // PENDING JOBS ARE PROCESSED BEFORE THE WORKERS ARE STOPPED, THE ONES
+  // SUBMITTED IN THE MEANTIME WAIT IN THE QUEUES FOR THE NEW WORKERS
+  stop();
+  m_num_threads = std::min(
+      num_threads > 0 ? num_threads : physical_core_count(), max_pool_threads);
+  m_priority = priority;
+  m_affinity = affinity;
+  start();
+}
+
+int ComputePool::get_num_threads() { return m_num_threads; }
+
+bool ComputePool::try_pop(int index, std::function<void()> &job) {
+  // OWN QUEUE FIRST, THEN STEAL FROM THE OTHER ONES
+  int n_queues = m_num_queues.load(std::memory_order_acquire);
+  for (int k(0); k < n_queues; k++) {
+    if (m_queues[(index + k) % n_queues]->jobs.pop(job))
+      return true;
+  }
+  return false;
+}
+
+void ComputePool::worker_loop(int index) {
+  configure_current_thread(m_priority, m_affinity);
+  std::function<void()> job;
+  while (true) {
+    if (try_pop(index, job)) {
+      m_pending--;
+      try {
+        job();
+      } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+      }
+      job = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> sleep_lock(m_sleep_mutex);
+    if (m_should_stop && m_pending <= 0)
+      return;
+    m_sleepers++;
+    m_sleep_condition.wait(sleep_lock,
+                           [this] { return m_pending > 0 || m_should_stop; });
+    m_sleepers--;
+  }
+}
+
+Strand::~Strand() { wait(); }
+
+bool Strand::submit(std::function<void()> job) {
+  if (!m_jobs.push(std::move(job)))
+    return false;
+  m_pending++;
+  schedule();
+  return true;
+}
+
+void Strand::schedule() {
+  if (m_scheduled.exchange(true))
+    return;
+  // A FULL POOL LEAVES THE JOBS TO THE NEXT SUBMISSION OR TO wait()
+  if (!ComputePool::get().submit([this] { drain(); }))
+    m_scheduled = false;
+}
+
+void Strand::drain() {
+  std::function<void()> job;
+  while (true) {
+    while (m_jobs.pop(job)) {
+      try {
+        job();
+      } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+      } catch (...) {
+        std::cerr << "unknown error in a compute job" << std::endl;
+      }
+      job = nullptr;
+      m_pending--;
+    }
+    // A JOB PUSHED AFTER THE LAST POP, BEFORE THE FLAG IS RESET, IS STILL
+    // RUN BY THIS DRAIN. NOTHING IS TOUCHED ONCE THE WAITERS ARE NOTIFIED
+    std::unique_lock<std::mutex> strand_lock(m_mutex);
+    m_scheduled = false;
+    if (m_jobs.empty() || m_scheduled.exchange(true)) {
+      m_idle_condition.notify_all();
+      return;
+    }
+  }
+}
+
+bool Strand::busy() { return m_pending > 0 || m_scheduled; }
+
+void Strand::wait() {
+  std::unique_lock<std::mutex> strand_lock(m_mutex);
+  while (m_pending > 0 || m_scheduled) {
+    if (!m_scheduled.exchange(true)) {
+      strand_lock.unlock();
+      drain();
+      strand_lock.lock();
+      continue;
+    }
+    m_idle_condition.wait(strand_lock);
+  }
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+int physical_core_count();
+
+// Bounded multi producer / multi consumer queue (after Dmitry Vyukov), lock
+// free and preallocated, so that pushing from the audio thread never blocks
+// nor allocates. Jobs should capture little enough state (e.g. two pointers)
+// for std::function to store them inline.
+template <class T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity);
+  bool push(T &&value); // FALSE IF FULL, value IS THEN LEFT UNTOUCHED
+  bool pop(T &value);   // FALSE IF EMPTY
+  bool empty();
+
+protected:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+  std::unique_ptr<Cell[]> m_cells;
+  size_t m_mask;
+  alignas(64) std::atomic<size_t> m_enqueue{0};
+  alignas(64) std::atomic<size_t> m_dequeue{0};
+};
+
+// NUMBER OF JOBS A WORKER QUEUE OR A STRAND HOLDS BEFORE SUBMISSIONS FAIL
+constexpr size_t pool_queue_capacity = 256;
+constexpr size_t strand_capacity = 64;
+constexpr int max_pool_threads = 64;
+
+// Process-wide work stealing pool running the model computations of every
+// nn~ instance. Each worker owns a queue, and idle workers steal jobs from
+// the queues of busy ones. Submitting never blocks, the queues outlive a
+// reconfiguration so that the audio thread keeps submitting while the
+// workers are restarted.
+class ComputePool {
+public:
+  static ComputePool &get();
+  ~ComputePool();
+
+  // FALSE IF EVERY QUEUE IS FULL, THE JOB IS THEN DROPPED
+  bool submit(std::function<void()> job);
+
+  // Restarts the workers with the given number of threads (physical core
+  // count if <= 0, at most max_pool_threads), scheduling priority (0 for the
+  // default policy, > 0 for a real-time priority) and cpu affinity (empty for
+  // no affinity).
+  void configure(int num_threads, int priority, std::vector<int> affinity);
+  int get_num_threads();
+
+protected:
+  ComputePool();
+  void start();
+  void stop();
+  void worker_loop(int index);
+  bool try_pop(int index, std::function<void()> &job);
+
+  struct WorkerQueue {
+    BoundedQueue<std::function<void()>> jobs{pool_queue_capacity};
+  };
+
+  std::mutex m_config_mutex, m_sleep_mutex;
+  std::condition_variable m_sleep_condition;
+  // ALLOCATED ON DEMAND, NEVER FREED BEFORE THE POOL
+  std::unique_ptr<WorkerQueue> m_queues[max_pool_threads];
+  std::atomic<int> m_num_queues{0};
+  std::vector<std::thread> m_workers;
+  std::atomic<int> m_pending{0};
+  std::atomic<int> m_sleepers{0}; // workers waiting, or about to
+  std::atomic<unsigned> m_next_queue{0};
+  std::atomic<bool> m_should_stop{false};
+  std::atomic<int> m_num_threads;
+  int m_priority;
+  std::vector<int> m_affinity;
+};
+
+// Runs the jobs submitted by a single instance on the pool, one at a time and
+// in submission order, as model calls of a given instance must not overlap.
+// Submitting never blocks nor allocates. A job throwing is reported and does
+// not prevent the next ones from running.
+class Strand {
+public:
+  ~Strand();
+  // FALSE IF TOO MANY JOBS ARE PENDING, THE JOB IS THEN DROPPED
+  bool submit(std::function<void()> job);
+  bool busy();
+  // RUNS THE PENDING JOBS IN THE CALLING THREAD IF THE POOL COULD NOT TAKE
+  // THEM, AND WAITS UNTIL EVERY JOB IS DONE
+  void wait();
+
+protected:
+  void schedule();
+  void drain();
+
+  BoundedQueue<std::function<void()>> m_jobs{strand_capacity};
+  std::atomic<int> m_pending{0};
+  std::atomic<bool> m_scheduled{false}; // a drain is queued or running
+  std::mutex m_mutex;
+  std::condition_variable m_idle_condition;
+};
+
+template <class T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) : m_mask(1) {
+  while (m_mask + 1 < capacity)
+    m_mask = (m_mask << 1) | 1;
+  m_cells = std::make_unique<Cell[]>(m_mask + 1);
+  for (size_t i(0); i <= m_mask; i++)
+    m_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template <class T> bool BoundedQueue<T>::push(T &&value) {
+  auto position = m_enqueue.load(std::memory_order_relaxed);
+  while (true) {
+    auto &cell = m_cells[position & m_mask];
+    auto sequence = cell.sequence.load(std::memory_order_acquire);
+    auto diff = intptr_t(sequence) - intptr_t(position);
+    if (!diff) {
+      if (m_enqueue.compare_exchange_weak(position, position + 1,
+                                          std::memory_order_relaxed)) {
+        cell.value = std::move(value);
+        cell.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      position = m_enqueue.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class T> bool BoundedQueue<T>::pop(T &value) {
+  auto position = m_dequeue.load(std::memory_order_relaxed);
+  while (true) {
+    auto &cell = m_cells[position & m_mask];
+    auto sequence = cell.sequence.load(std::memory_order_acquire);
+    auto diff = intptr_t(sequence) - intptr_t(position + 1);
+    if (!diff) {
+      if (m_dequeue.compare_exchange_weak(position, position + 1,
+                                          std::memory_order_relaxed)) {
+        value = std::move(cell.value);
+        cell.value = T();
+        cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      position = m_dequeue.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class T> bool BoundedQueue<T>::empty() {
+  auto position = m_dequeue.load(std::memory_order_relaxed);
+  auto sequence =
+      m_cells[position & m_mask].sequence.load(std::memory_order_acquire);
+  return intptr_t(sequence) - intptr_t(position + 1) < 0;
+}
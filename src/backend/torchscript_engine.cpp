@@ -0,0 +1,208 @@
+#include "torchscript_engine.h"
+#include "model_registry.h"
+#include <stdexcept>
+
+#define CPU torch::kCPU
+
+static std::vector<c10::IValue>
+read_attribute(torch::jit::script::Module &model, const std::string &name) {
+  std::vector<c10::IValue> getter_inputs = {}, attributes;
+  auto getter = model.get_method("get_" + name);
+  auto output = getter(getter_inputs);
+  if (output.isList())
+    attributes = output.toList().vec();
+  else if (output.isTuple())
+    attributes = output.toTuple()->elements();
+  else
+    attributes.push_back(output);
+  return attributes;
+}
+
+static std::vector<std::string> get_labels(torch::jit::script::Module &model,
+                                           const std::string &attribute) {
+  std::vector<std::string> labels;
+  try {
+    auto label_list = model.attr(attribute).toList();
+    for (int i = 0; i < label_list.size(); i++)
+      labels.push_back(label_list.get(i).toStringRef());
+  } catch (...) {
+  }
+  return labels;
+}
+
+static std::shared_ptr<const ModelMetadata>
+read_metadata(torch::jit::script::Module &model) {
+  auto metadata = std::make_shared<ModelMetadata>();
+  std::vector<c10::IValue> dumb_input = {};
+
+  for (const auto &m : model.get_methods())
+    metadata->methods.push_back(m.name());
+  for (const auto &attribute : model.named_attributes())
+    metadata->attributes.push_back(attribute.name);
+
+  try {
+    auto methods_from_model =
+        model.get_method("get_methods")(dumb_input).toList();
+    for (int i = 0; i < methods_from_model.size(); i++)
+      metadata->available_methods.push_back(
+          methods_from_model.get(i).toStringRef());
+  } catch (...) {
+    for (const auto &m : metadata->methods) {
+      if (model.hasattr(m + "_params"))
+        metadata->available_methods.push_back(m);
+    }
+  }
+
+  try {
+    auto attributes_from_model =
+        model.get_method("get_attributes")(dumb_input).toList();
+    for (int i = 0; i < attributes_from_model.size(); i++)
+      metadata->settable_attributes.push_back(
+          attributes_from_model.get(i).toStringRef());
+  } catch (...) {
+    for (const auto &a : metadata->attributes) {
+      if (model.hasattr(a + "_params"))
+        metadata->settable_attributes.push_back(a);
+    }
+  }
+
+  for (const auto &method : metadata->available_methods) {
+    try {
+      auto p = model.attr(method + "_params").toTensor().to(CPU);
+      metadata->method_params[method] = {
+          p[0].item().to<int>(), p[1].item().to<int>(), p[2].item().to<int>(),
+          p[3].item().to<int>()};
+    } catch (...) {
+    }
+    metadata->input_labels[method] =
+        get_labels(model, method + "_input_labels");
+    metadata->output_labels[method] =
+        get_labels(model, method + "_output_labels");
+  }
+
+  for (const auto &attribute : metadata->settable_attributes) {
+    try {
+      auto p = model.attr(attribute + "_params").toTensor().to(CPU);
+      auto &types = metadata->attribute_types[attribute];
+      for (int i = 0; i < p.size(0); i++)
+        types.push_back(p[i].item().toInt());
+      if (types == std::vector<int>{2} &&
+          metadata->float_attributes.size() < max_float_attributes)
+        metadata->float_attributes.push_back(attribute);
+    } catch (...) {
+    }
+  }
+  return metadata;
+}
+
+void TorchScriptEngine::load(const std::string &path,
+                             const EngineSettings &settings) {
+  // WEIGHTS ARE SHARED WITH EVERY INSTANCE USING THE SAME MODEL AND DEVICE
+  m_shared_model = ModelRegistry::get().acquire(
+      path, settings.device, settings.force_reload,
+      settings.optimization_level, settings.precision, &m_precision);
+  m_model = settings.shared ? *m_shared_model
+                            : instantiate_shared_model(*m_shared_model);
+  m_path = path;
+  m_settings = settings;
+  m_settings.force_reload = false;
+  m_metadata = read_metadata(m_model);
+  bind_methods();
+}
+
+std::shared_ptr<Engine>
+TorchScriptEngine::reconfigure(const EngineSettings &settings) {
+  auto engine = std::make_shared<TorchScriptEngine>();
+  engine->m_path = m_path;
+  engine->m_settings = m_settings;
+  engine->m_settings.device = settings.device;
+  engine->m_settings.shared = settings.shared;
+  engine->m_metadata = m_metadata;
+  engine->m_precision = m_precision;
+  engine->m_shared_model = m_shared_model;
+
+  // SWITCH TO THE SHARED COPY OF THE MODEL LIVING ON THE NEW DEVICE
+  bool moved = settings.device != m_settings.device;
+  if (moved)
+    engine->m_shared_model = ModelRegistry::get().acquire(
+        m_path, settings.device, false, m_settings.optimization_level,
+        m_settings.precision, &engine->m_precision);
+
+  // BATCHED INSTANCES ALL RUN ON THE SHARED MODULE, THUS SHARING ITS
+  // ATTRIBUTES AND BUFFERS WITH THE REST OF THE GROUP
+  engine->m_model = settings.shared
+                        ? *engine->m_shared_model
+                        : instantiate_shared_model(*engine->m_shared_model);
+  if (moved || !settings.shared)
+    copy_model_attributes(m_model, engine->m_model);
+  engine->bind_methods();
+  return engine;
+}
+
+void TorchScriptEngine::bind_methods() {
+  m_methods.clear();
+  for (const auto &name : m_metadata->available_methods) {
+    if (auto method = m_model.find_method(name))
+      m_methods.push_back(*method);
+  }
+  m_stack.reserve(2);
+}
+
+std::shared_ptr<const ModelMetadata> TorchScriptEngine::get_metadata() {
+  return m_metadata;
+}
+
+int TorchScriptEngine::get_precision() { return m_precision; }
+
+int TorchScriptEngine::get_method(const std::string &method) {
+  for (int i(0); i < m_methods.size(); i++) {
+    if (m_methods[i].name() == method)
+      return i;
+  }
+  return -1;
+}
+
+at::Tensor TorchScriptEngine::run(int method, const at::Tensor &input) {
+  m_stack.clear();
+  m_stack.emplace_back(input);
+  m_methods.at(method).run(m_stack);
+  return m_stack.back().toTensor();
+}
+
+std::vector<c10::IValue>
+TorchScriptEngine::get_attribute(const std::string &name) {
+  return read_attribute(m_model, name);
+}
+
+void TorchScriptEngine::set_attribute(const std::string &name,
+                                      const std::vector<c10::IValue> &inputs) {
+  auto setter = m_model.get_method("set_" + name);
+  if (setter(inputs).toInt() != 0)
+    throw std::runtime_error("setter returned -1");
+}
+
+// RUNS THE METHODS EXPOSING PARAMETERS ON ZEROS, WITH THE SHAPES USED DURING
+// PERFORM. GRAPH EXECUTORS ARE SHARED BY EVERY INSTANCE OF A MODEL, SO THAT
+// WARMING UP A THROWAWAY INSTANCE LEAVES THE STATE OF THE OTHER ONES UNTOUCHED
+void TorchScriptEngine::warm_up(int n_iterations, int n_vec, int n_batches) {
+  c10::InferenceMode guard;
+  auto model = instantiate_shared_model(*m_shared_model);
+  auto dtype = precision_dtype(m_precision);
+  for (const auto &method : model.get_methods()) {
+    try {
+      auto p = model.attr(method.name() + "_params").toTensor().to(CPU);
+      auto in_dim = p[0].item().to<int>();
+      auto in_ratio = p[1].item().to<int>();
+      auto input = torch::zeros(
+          {n_batches, in_dim, n_vec / in_ratio},
+          torch::TensorOptions().dtype(dtype).device(m_settings.device));
+      for (int i(0); i < n_iterations; i++)
+        method({input});
+    } catch (...) {
+    }
+  }
+}
+
+const void *TorchScriptEngine::get_batching_key() {
+  return m_shared_model.get();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "engine.h"
+#include <torch/script.h>
+
+// Runs TorchScript models through the jit. Weights are shared process-wide by
+// the ModelRegistry, while each engine runs its own instance of the module
+// (or the shared module itself when batching), see instantiate_shared_model.
+class TorchScriptEngine : public Engine {
+public:
+  void load(const std::string &path, const EngineSettings &settings) override;
+  std::shared_ptr<Engine> reconfigure(const EngineSettings &settings) override;
+  std::shared_ptr<const ModelMetadata> get_metadata() override;
+  int get_precision() override;
+  int get_method(const std::string &method) override;
+  at::Tensor run(int method, const at::Tensor &input) override;
+  std::vector<c10::IValue> get_attribute(const std::string &name) override;
+  void set_attribute(const std::string &name,
+                     const std::vector<c10::IValue> &inputs) override;
+  void warm_up(int n_iterations, int n_vec, int n_batches) override;
+  const void *get_batching_key() override;
+
+protected:
+  void bind_methods();
+
+  std::string m_path;
+  EngineSettings m_settings;
+  int m_precision = 0;
+  std::shared_ptr<torch::jit::script::Module> m_shared_model;
+  torch::jit::script::Module m_model;
+  std::shared_ptr<const ModelMetadata> m_metadata;
+  std::vector<torch::jit::Method> m_methods; // available methods, by id
+  std::vector<torch::jit::IValue> m_stack;
+};
@@ -0,0 +1,47 @@
+#include "bench_utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+// EVERY OPERATOR NEW OF THE PROCESS IS COUNTED
+static std::atomic<size_t> n_allocations{0};
+
+void *operator new(size_t size) {
+  n_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+size_t get_allocation_count() {
+  return n_allocations.load(std::memory_order_relaxed);
+}
+
+double peak_memory() {
+#if defined(_WIN32)
+  return 0;
+#else
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1048576.;
+#else
+  return usage.ru_maxrss / 1024.;
+#endif
+#endif
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  if (!sorted.size())
+    return 0;
+  auto index = std::min(size_t(std::ceil(p * sorted.size())), sorted.size());
+  return sorted[std::max(index, size_t(1)) - 1];
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Helpers shared by the headless tools of the backend.
+
+constexpr double pi = 3.14159265358979323846;
+
+// NUMBER OF OPERATOR NEW CALLS SINCE THE START OF THE PROCESS. TENSOR STORAGE
+// GOES THROUGH THE C10 ALLOCATORS AND IS ONLY VISIBLE IN THE MEMORY FOOTPRINT.
+size_t get_allocation_count();
+// PEAK RESIDENT SET SIZE, IN MEGABYTES
+double peak_memory();
+// NEAREST RANK PERCENTILE OF SORTED VALUES, p IN [0, 1]
+double percentile(const std::vector<double> &sorted, double p);
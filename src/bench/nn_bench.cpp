@@ -0,0 +1,168 @@
+// Headless benchmark of the nn~ backend. Drives Backend::perform in a loop
+// the same way the externals do, and reports the real-time factor, the
+// latency percentiles, the allocations per call and the memory footprint.
+//
+// Reproducible fixtures are generated with extras/generate_test_model.py:
+//   python extras/generate_test_model.py
+//   nn_bench multieffect.ts --method thru --buffer 2048
+
+#include "../backend/backend.h"
+#include "bench_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+  std::string path, method = "forward", device = "cpu", precision = "fp32";
+  std::string engine = "auto";
+  int buffer_size = 4096, n_batches = 1, n_threads = 0, n_iterations = 1000;
+  int n_warmup = 10, sample_rate = 44100;
+};
+
+static void usage() {
+  std::cout
+      << "usage: nn_bench model.ts [--method forward] [--buffer 4096]\n"
+         "                [--batches 1] [--device cpu|gpu|cuda:1|auto]\n"
+         "                [--threads 0]\n"
+         "                [--iterations 1000] [--warmup 10] [--sr 44100]\n"
+         "                [--precision fp32|fp16|bf16]\n"
+         "                [--engine auto|torchscript]\n";
+}
+
+static int parse_options(int argc, char **argv, BenchOptions &options) {
+  if (argc < 2)
+    return 1;
+  options.path = argv[1];
+  for (int i(2); i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 >= argc)
+      return 1;
+    std::string value = argv[++i];
+    if (option == "--method")
+      options.method = value;
+    else if (option == "--device")
+      options.device = value;
+    else if (option == "--buffer")
+      options.buffer_size = std::stoi(value);
+    else if (option == "--batches")
+      options.n_batches = std::stoi(value);
+    else if (option == "--threads")
+      options.n_threads = std::stoi(value);
+    else if (option == "--iterations")
+      options.n_iterations = std::stoi(value);
+    else if (option == "--warmup")
+      options.n_warmup = std::stoi(value);
+    else if (option == "--precision")
+      options.precision = value;
+    else if (option == "--engine")
+      options.engine = value;
+    else if (option == "--sr")
+      options.sample_rate = std::stoi(value);
+    else
+      return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  try {
+    if (parse_options(argc, argv, options)) {
+      usage();
+      return 1;
+    }
+  } catch (const std::exception &e) {
+    usage();
+    return 1;
+  }
+
+  if (options.n_threads > 0)
+    Backend::set_thread_budget(options.n_threads, 0);
+
+  Backend backend;
+  if (backend.set_device(options.device) ||
+      backend.set_precision(options.precision) ||
+      backend.set_engine(options.engine))
+    return 1;
+  if (backend.load(options.path)) {
+    std::cerr << "could not load " << options.path << std::endl;
+    return 1;
+  }
+  auto memory_loaded = peak_memory();
+
+  auto params = backend.get_method_params(options.method);
+  if (!params.size()) {
+    std::cerr << "method " << options.method << " not found" << std::endl;
+    return 1;
+  }
+  auto higher_ratio = backend.get_higher_ratio();
+  if (options.buffer_size % higher_ratio) {
+    std::cerr << "buffer size must be a multiple of " << higher_ratio
+              << std::endl;
+    return 1;
+  }
+
+  // SAME LAYOUT AS THE EXTERNALS, CHANNEL MAJOR THEN BATCH
+  auto n_inputs = params[0] * options.n_batches;
+  auto n_outputs = params[2] * options.n_batches;
+  std::vector<std::vector<float>> in_memory(
+      n_inputs, std::vector<float>(options.buffer_size));
+  std::vector<std::vector<float>> out_memory(
+      n_outputs, std::vector<float>(options.buffer_size));
+  std::vector<float *> in_buffer, out_buffer;
+  for (auto &channel : in_memory) {
+    for (int i(0); i < options.buffer_size; i++)
+      channel[i] = std::sin(i * 2 * pi * 440 / options.sample_rate);
+    in_buffer.push_back(channel.data());
+  }
+  for (auto &channel : out_memory)
+    out_buffer.push_back(channel.data());
+
+  for (int i(0); i < options.n_warmup; i++)
+    backend.perform(in_buffer, out_buffer, options.buffer_size,
+                    options.method, options.n_batches);
+  backend.get_stats().reset();
+
+  std::vector<double> latencies;
+  latencies.reserve(options.n_iterations);
+  auto allocations = get_allocation_count();
+  auto start = std::chrono::steady_clock::now();
+  for (int i(0); i < options.n_iterations; i++) {
+    auto call_start = std::chrono::steady_clock::now();
+    backend.perform(in_buffer, out_buffer, options.buffer_size,
+                    options.method, options.n_batches);
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - call_start;
+    latencies.push_back(elapsed.count());
+  }
+  std::chrono::duration<double> total =
+      std::chrono::steady_clock::now() - start;
+  allocations = get_allocation_count() - allocations;
+
+  std::sort(latencies.begin(), latencies.end());
+  auto audio_duration = double(options.n_iterations) * options.buffer_size /
+                        options.sample_rate;
+  auto budget = 1e6 * options.buffer_size / options.sample_rate;
+
+  std::cout << "model: " << options.path << " (" << options.method << ")\n"
+            << "buffer: " << options.buffer_size << " samples x "
+            << options.n_batches << " batch(es), device "
+            << backend.get_device() << ", " << backend.get_precision()
+            << ", " << Backend::get_thread_budget()[0]
+            << " intra-op thread(s)\n"
+            << "real-time factor: " << audio_duration / total.count() << "\n"
+            << "latency (us): p50 " << percentile(latencies, .5) << ", p95 "
+            << percentile(latencies, .95) << ", p99 "
+            << percentile(latencies, .99) << ", max " << latencies.back()
+            << " (budget " << budget << ")\n"
+            << "allocations per call: "
+            << double(allocations) / options.n_iterations << "\n"
+            << "peak memory (MB): " << memory_loaded << " after loading, "
+            << peak_memory() << " after the benchmark\n";
+  for (const auto &line : backend.get_stats().format())
+    std::cout << "  " << line << "\n";
+  return 0;
+}
@@ -0,0 +1,583 @@
+// Regression suite of the nn~ backend. Runs every method of the given models
+// over a grid of buffer sizes, batches, intra-op thread counts, devices and
+// code paths, compares the outputs with golden files, compares the real-time
+// factors with recorded baselines, and writes a JSON report. The exit code is
+// non zero as soon as a case fails, so that the suite can gate a build.
+//
+// Code paths:
+//   perform            Backend::perform, as the Pd external drives it
+//   frontend           vectors of 64 samples through the circular buffers and
+//                      the buffer pipeline shared with the Max externals
+//   frontend_threaded  same, the model calls running on the compute pool
+//
+// Reproducible fixtures are generated with extras/generate_test_model.py:
+//   python extras/generate_test_model.py
+//   nn_suite multieffect.ts conv.ts gru.ts --golden goldens --update
+//   nn_suite multieffect.ts conv.ts gru.ts --golden goldens --report out.json
+//
+// Goldens are compared bit for bit by default. They are only reproducible
+// with the same libtorch build on the same hardware, other setups should
+// record their own goldens or pass a --tolerance.
+
+#include "../backend/backend.h"
+#include "../backend/thread_pool.h"
+#include "../frontend/maxmsp/shared/circular_buffer.h"
+#include "../frontend/maxmsp/shared/pipeline.h"
+#include "bench_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <torch/torch.h>
+#include <vector>
+
+// VECTOR SIZE OF THE EMULATED HOST
+constexpr int host_vec_size = 64;
+
+struct SuiteOptions {
+  std::vector<std::string> models;
+  std::string golden_dir, report_path;
+  std::vector<int> buffer_sizes = {512, 2048, 4096}, batches = {1, 4};
+  std::vector<int> threads = {0, 1}; // 0 IS THE DEFAULT BUDGET
+  std::vector<std::string> devices = {"cpu"};
+  std::vector<std::string> paths = {"perform", "frontend",
+                                    "frontend_threaded"};
+  int n_golden = 8, n_iterations = 50, n_warmup = 2, sample_rate = 44100;
+  double tolerance = 0, rtf_tolerance = .25;
+  bool update = false;
+};
+
+struct SuiteCase {
+  std::string model, method, path, device;
+  int buffer_size, n_batches, n_threads;
+};
+
+struct CaseResult {
+  std::string golden = "missing"; // match, mismatch, missing or written
+  std::string error;
+  double rtf = 0, baseline_rtf = 0, p50 = 0, p99 = 0, allocations = 0;
+  double max_error = 0;
+  bool rtf_regression = false;
+  bool failed() const {
+    return error.size() || rtf_regression ||
+           (golden != "match" && golden != "written");
+  }
+};
+
+static void usage() {
+  std::cout
+      << "usage: nn_suite model.ts [model.ts ...] --golden dir [--update]\n"
+         "                [--report report.json]\n"
+         "                [--buffers 512,2048,4096] [--batches 1,4]\n"
+         "                [--threads 0,1] [--devices cpu,gpu]\n"
+         "                [--paths perform,frontend,frontend_threaded]\n"
+         "                [--golden-buffers 8] [--iterations 50] [--sr 44100]\n"
+         "                [--tolerance 0] [--rtf-tolerance 0.25]\n";
+}
+
+static std::vector<std::string> split(const std::string &list, char delimiter) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  for (std::string item; std::getline(stream, item, delimiter);)
+    if (item.size())
+      items.push_back(item);
+  return items;
+}
+
+static std::vector<int> split_int(const std::string &list) {
+  std::vector<int> values;
+  for (const auto &item : split(list, ','))
+    values.push_back(std::stoi(item));
+  return values;
+}
+
+static int parse_options(int argc, char **argv, SuiteOptions &options) {
+  int i(1);
+  for (; i < argc && std::strncmp(argv[i], "--", 2); i++)
+    options.models.push_back(argv[i]);
+  for (; i < argc; i++) {
+    std::string option = argv[i];
+    if (option == "--update") {
+      options.update = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return 1;
+    std::string value = argv[++i];
+    if (option == "--golden")
+      options.golden_dir = value;
+    else if (option == "--report")
+      options.report_path = value;
+    else if (option == "--buffers")
+      options.buffer_sizes = split_int(value);
+    else if (option == "--batches")
+      options.batches = split_int(value);
+    else if (option == "--threads")
+      options.threads = split_int(value);
+    else if (option == "--devices")
+      options.devices = split(value, ',');
+    else if (option == "--paths")
+      options.paths = split(value, ',');
+    else if (option == "--golden-buffers")
+      options.n_golden = std::stoi(value);
+    else if (option == "--iterations")
+      options.n_iterations = std::stoi(value);
+    else if (option == "--sr")
+      options.sample_rate = std::stoi(value);
+    else if (option == "--tolerance")
+      options.tolerance = std::stod(value);
+    else if (option == "--rtf-tolerance")
+      options.rtf_tolerance = std::stod(value);
+    else
+      return 1;
+  }
+  return !options.models.size() || options.golden_dir.empty();
+}
+
+static std::string model_name(const std::string &path) {
+  auto name = path.substr(path.find_last_of("/\\") + 1);
+  return name.substr(0, name.find_last_of('.'));
+}
+
+// FILE STEM OF THE GOLDEN OF A CASE, ALSO ITS KEY IN THE BASELINES
+static std::string case_key(const SuiteCase &c) {
+  auto device = c.device;
+  std::replace(device.begin(), device.end(), ':', '_');
+  return c.model + "-" + c.method + "-" + c.path + "-b" +
+         std::to_string(c.buffer_size) + "-n" + std::to_string(c.n_batches) +
+         "-t" + std::to_string(c.n_threads) + "-" + device;
+}
+
+// DETERMINISTIC INPUT, A SINE OF ITS OWN FREQUENCY ON EVERY CHANNEL OF EVERY
+// BATCH, CONTINUOUS ACROSS BUFFERS
+static float test_signal(int channel, long sample, int sample_rate) {
+  return float(.5 * std::sin(2 * pi * 110 * (channel + 1) *
+                             (double(sample) / sample_rate)));
+}
+
+// Computes the next buffer of every output channel of a case. Outputs are
+// indexed batch major (b * out_dim + d), as perform_prepared writes them.
+class CasePath {
+public:
+  CasePath(Backend &backend, const SuiteCase &c, std::vector<int> params,
+           int sample_rate)
+      : m_backend(backend), m_method(c.method), m_buffer_size(c.buffer_size),
+        m_n_batches(c.n_batches), m_in_dim(params[0]), m_in_ratio(params[1]),
+        m_out_dim(params[2]), m_sample_rate(sample_rate),
+        m_out_memory(m_out_dim * m_n_batches,
+                     std::vector<float>(m_buffer_size)) {
+    for (auto &channel : m_out_memory)
+      m_outputs.push_back(channel.data());
+  }
+  virtual ~CasePath() = default;
+  virtual void process(long position) = 0;
+  const std::vector<std::vector<float>> &outputs() { return m_out_memory; }
+
+protected:
+  Backend &m_backend;
+  std::string m_method;
+  int m_buffer_size, m_n_batches, m_in_dim, m_in_ratio, m_out_dim;
+  int m_sample_rate;
+  std::vector<std::vector<float>> m_out_memory;
+  std::vector<float *> m_outputs;
+};
+
+class PerformPath : public CasePath {
+public:
+  PerformPath(Backend &backend, const SuiteCase &c, std::vector<int> params,
+              int sample_rate)
+      : CasePath(backend, c, params, sample_rate),
+        m_in_memory(m_in_dim * m_n_batches,
+                    std::vector<float>(m_buffer_size)) {
+    for (auto &channel : m_in_memory)
+      m_inputs.push_back(channel.data());
+  }
+
+  void process(long position) override {
+    // CHANNEL MAJOR THEN BATCH, AS Backend::perform EXPECTS
+    for (int d(0); d < m_in_dim; d++) {
+      for (int b(0); b < m_n_batches; b++) {
+        auto in = m_inputs[d * m_n_batches + b];
+        for (int i(0); i < m_buffer_size; i++)
+          in[i] = test_signal(b * m_in_dim + d, position + i, m_sample_rate);
+      }
+    }
+    m_backend.perform(m_inputs, m_outputs, m_buffer_size, m_method,
+                      m_n_batches);
+  }
+
+protected:
+  std::vector<std::vector<float>> m_in_memory;
+  std::vector<float *> m_inputs;
+};
+
+// Buffering built on the circular buffers and the pipeline of the Max
+// externals: the host vectors go through circular buffers, every full buffer
+// is handed over to a slot of the pipeline, and the backend copies the slot
+// into the model input. The perform routines of the externals are not shared,
+// so their own logic (voices, gate, averaging, dropped buffers, resets) is not
+// covered. Threaded calls are awaited before the next buffer, so that no
+// deadline is ever missed and the output stays deterministic, one buffer
+// later.
+class FrontendPath : public CasePath {
+public:
+  FrontendPath(Backend &backend, const SuiteCase &c, std::vector<int> params,
+               int sample_rate, bool use_thread)
+      : CasePath(backend, c, params, sample_rate), m_use_thread(use_thread),
+        m_host_input(host_vec_size) {
+    m_method_id = m_backend.get_method_id(m_method);
+    m_backend.prepare(m_method_id, m_buffer_size, m_n_batches);
+
+    auto n_in = m_in_dim * m_n_batches, n_out = m_out_dim * m_n_batches;
+    m_in_buffer = std::make_unique<circular_buffer<float, float>[]>(n_in);
+    for (int i(0); i < n_in; i++)
+      m_in_buffer[i].initialize(m_buffer_size);
+    m_out_buffer = std::make_unique<circular_buffer<float, float>[]>(n_out);
+    for (int i(0); i < n_out; i++) {
+      m_out_buffer[i].initialize(2 * m_buffer_size);
+      m_out_buffer[i].prime(m_buffer_size -
+                            std::gcd(host_vec_size, m_buffer_size));
+    }
+    m_pipeline.initialize(1, n_in, m_buffer_size / m_in_ratio, n_out,
+                          m_buffer_size);
+  }
+
+  ~FrontendPath() { m_strand.wait(); }
+
+  void process(long position) override {
+    for (int offset(0); offset < m_buffer_size; offset += host_vec_size)
+      perform_vector(position + offset, offset);
+  }
+
+protected:
+  void perform_vector(long position, int out_offset) {
+    for (int offset(0), n(0); offset < host_vec_size; offset += n) {
+      n = std::min(host_vec_size - offset,
+                   m_buffer_size - int(m_in_buffer[0].available()));
+      for (int c(0); c < m_in_dim * m_n_batches; c++) {
+        for (int i(0); i < n; i++)
+          m_host_input[i] = test_signal(c, position + offset + i,
+                                        m_sample_rate);
+        m_in_buffer[c].put(m_host_input.data(), n);
+      }
+
+      if (m_in_buffer[0].full())
+        perform_buffer();
+
+      for (int c(0); c < m_out_dim * m_n_batches; c++)
+        m_out_buffer[c].get(m_outputs[c] + out_offset + offset, n);
+    }
+  }
+
+  void perform_buffer() {
+    if (m_use_thread)
+      m_strand.wait();
+    auto slot = m_pipeline.current();
+    auto n_in = m_in_dim * m_n_batches, n_out = m_out_dim * m_n_batches;
+
+    for (int c(0); c < n_out; c++) {
+      if (slot->has_result)
+        m_out_buffer[c].put(slot->output[c], m_buffer_size);
+      else if (m_use_thread)
+        m_out_buffer[c].prime(m_buffer_size);
+    }
+
+    m_pipeline.set_channels(slot, n_in, n_out);
+    for (int c(0); c < n_in; c++)
+      m_in_buffer[c].get(slot->input[c], m_buffer_size, m_in_ratio);
+
+    if (!m_use_thread) {
+      model_perform(slot);
+      for (int c(0); c < n_out; c++)
+        m_out_buffer[c].put(slot->output[c], m_buffer_size);
+    } else {
+      slot->has_result = true;
+      m_strand.submit([this, slot] { model_perform(slot); });
+      m_pipeline.advance();
+    }
+  }
+
+  void model_perform(buffer_pipeline::slot *slot) {
+    m_backend.perform_prepared(slot->input, slot->output, m_buffer_size,
+                               m_method_id, m_n_batches);
+  }
+
+  bool m_use_thread;
+  int m_method_id;
+  std::vector<float> m_host_input;
+  std::unique_ptr<circular_buffer<float, float>[]> m_in_buffer, m_out_buffer;
+  buffer_pipeline m_pipeline;
+  Strand m_strand;
+};
+
+static std::map<std::string, double> read_baselines(const std::string &path) {
+  std::map<std::string, double> baselines;
+  std::ifstream file(path);
+  std::string key;
+  double rtf;
+  while (file >> key >> rtf)
+    baselines[key] = rtf;
+  return baselines;
+}
+
+static void write_baselines(const std::string &path,
+                            const std::map<std::string, double> &baselines) {
+  std::ofstream file(path);
+  for (const auto &baseline : baselines)
+    file << baseline.first << "\t" << baseline.second << "\n";
+}
+
+static bool read_golden(const std::string &path, std::vector<float> &golden) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    return false;
+  golden.resize(size_t(file.tellg()) / sizeof(float));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(golden.data()),
+            golden.size() * sizeof(float));
+  return bool(file);
+}
+
+static bool write_golden(const std::string &path,
+                         const std::vector<float> &output) {
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(output.data()),
+             output.size() * sizeof(float));
+  return bool(file);
+}
+
+static void check_golden(const SuiteOptions &options, const SuiteCase &c,
+                         const std::vector<float> &output,
+                         CaseResult &result) {
+  auto path = options.golden_dir + "/" + case_key(c) + ".f32";
+  if (options.update) {
+    result.golden = write_golden(path, output) ? "written" : "missing";
+    return;
+  }
+  std::vector<float> golden;
+  if (!read_golden(path, golden))
+    return;
+  if (golden.size() != output.size()) {
+    result.golden = "mismatch";
+    result.max_error = INFINITY;
+    return;
+  }
+  bool identical = !std::memcmp(golden.data(), output.data(),
+                                output.size() * sizeof(float));
+  for (int i(0); i < output.size(); i++) {
+    auto error = std::abs(double(output[i]) - golden[i]);
+    // NAN IS NEVER WITHIN THE TOLERANCE
+    result.max_error = std::isnan(error) ? INFINITY
+                                         : std::max(result.max_error, error);
+  }
+  if (options.tolerance > 0)
+    identical = result.max_error <= options.tolerance;
+  result.golden = identical ? "match" : "mismatch";
+}
+
+static CaseResult run_case(const SuiteOptions &options, const SuiteCase &c,
+                           const std::string &model_path) {
+  CaseResult result;
+  Backend backend;
+  if (backend.set_device(c.device)) {
+    result.error = "unknown device";
+    return result;
+  }
+  if (backend.load(model_path)) {
+    result.error = "could not load the model";
+    return result;
+  }
+  auto params = backend.get_method_params(c.method);
+
+  std::unique_ptr<CasePath> path;
+  if (c.path == "perform")
+    path = std::make_unique<PerformPath>(backend, c, params,
+                                         options.sample_rate);
+  else
+    path = std::make_unique<FrontendPath>(backend, c, params,
+                                          options.sample_rate,
+                                          c.path == "frontend_threaded");
+
+  // THE FIRST BUFFERS OF EVERY OUTPUT CHANNEL, FROM A FRESHLY LOADED MODEL
+  std::vector<float> output;
+  long position = 0;
+  for (int i(0); i < options.n_golden; i++, position += c.buffer_size) {
+    path->process(position);
+    for (const auto &channel : path->outputs())
+      output.insert(output.end(), channel.begin(), channel.end());
+  }
+  check_golden(options, c, output, result);
+
+  for (int i(0); i < options.n_warmup; i++, position += c.buffer_size)
+    path->process(position);
+
+  // LATENCIES ARE THE TIME SPENT IN THE CALLING (AUDIO) THREAD
+  std::vector<double> latencies;
+  latencies.reserve(options.n_iterations);
+  auto allocations = get_allocation_count();
+  auto start = std::chrono::steady_clock::now();
+  for (int i(0); i < options.n_iterations; i++, position += c.buffer_size) {
+    auto call_start = std::chrono::steady_clock::now();
+    path->process(position);
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - call_start;
+    latencies.push_back(elapsed.count());
+  }
+  path.reset(); // WAITS FOR THE LAST THREADED CALL
+  std::chrono::duration<double> total =
+      std::chrono::steady_clock::now() - start;
+  allocations = get_allocation_count() - allocations;
+
+  std::sort(latencies.begin(), latencies.end());
+  result.rtf = double(options.n_iterations) * c.buffer_size /
+               options.sample_rate / total.count();
+  result.p50 = percentile(latencies, .5);
+  result.p99 = percentile(latencies, .99);
+  result.allocations = double(allocations) / options.n_iterations;
+  return result;
+}
+
+static std::string json_string(const std::string &value) {
+  std::string escaped = "\"";
+  for (auto c : value) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+static double json_number(double value) {
+  return std::isfinite(value) ? value : -1;
+}
+
+static void write_report(const std::string &path,
+                         const std::vector<SuiteCase> &cases,
+                         const std::vector<CaseResult> &results) {
+  std::ofstream file(path);
+  int n_failed = 0;
+  file << "{\n  \"cases\": [\n";
+  for (int i(0); i < cases.size(); i++) {
+    const auto &c = cases[i];
+    const auto &r = results[i];
+    n_failed += r.failed();
+    file << "    {\"model\": " << json_string(c.model)
+         << ", \"method\": " << json_string(c.method)
+         << ", \"path\": " << json_string(c.path)
+         << ", \"device\": " << json_string(c.device)
+         << ", \"buffer\": " << c.buffer_size
+         << ", \"batches\": " << c.n_batches
+         << ", \"threads\": " << c.n_threads << ", \"rtf\": " << r.rtf
+         << ", \"baseline_rtf\": " << r.baseline_rtf
+         << ", \"latency_p50_us\": " << r.p50
+         << ", \"latency_p99_us\": " << r.p99
+         << ", \"allocations_per_call\": " << r.allocations
+         << ", \"golden\": " << json_string(r.golden)
+         << ", \"max_error\": " << json_number(r.max_error)
+         << ", \"rtf_regression\": " << (r.rtf_regression ? "true" : "false")
+         << ", \"error\": " << json_string(r.error)
+         << ", \"passed\": " << (r.failed() ? "false" : "true") << "}"
+         << (i + 1 < cases.size() ? ",\n" : "\n");
+  }
+  file << "  ],\n  \"passed\": " << cases.size() - n_failed
+       << ",\n  \"failed\": " << n_failed
+       << ",\n  \"peak_memory_mb\": " << peak_memory() << "\n}\n";
+}
+
+int main(int argc, char **argv) {
+  SuiteOptions options;
+  try {
+    if (parse_options(argc, argv, options)) {
+      usage();
+      return 1;
+    }
+  } catch (const std::exception &e) {
+    usage();
+    return 1;
+  }
+  if (torch::cuda::is_available() || torch::hasMPS()) {
+    if (std::find(options.devices.begin(), options.devices.end(), "gpu") ==
+        options.devices.end())
+      options.devices.push_back("gpu");
+  }
+  // THE DEFAULT BUDGET IS SET BY THE FIRST BACKEND
+  Backend probe;
+  auto default_threads = Backend::get_thread_budget()[0];
+
+  // ENUMERATE THE CASES, THE METHODS BEING THE ONES OF EACH MODEL
+  std::vector<SuiteCase> cases;
+  std::vector<std::string> case_paths;
+  for (const auto &model_path : options.models) {
+    Backend backend;
+    if (backend.load(model_path)) {
+      std::cerr << "could not load " << model_path << std::endl;
+      return 1;
+    }
+    auto higher_ratio = backend.get_higher_ratio();
+    for (const auto &method : backend.get_available_methods()) {
+      for (auto buffer_size : options.buffer_sizes) {
+        if (buffer_size % higher_ratio || buffer_size % host_vec_size)
+          continue;
+        for (auto n_batches : options.batches)
+          for (auto n_threads : options.threads)
+            for (const auto &device : options.devices)
+              for (const auto &path : options.paths) {
+                cases.push_back({model_name(model_path), method, path, device,
+                                 buffer_size, n_batches,
+                                 n_threads > 0 ? n_threads : default_threads});
+                case_paths.push_back(model_path);
+              }
+      }
+    }
+  }
+
+  if (options.update)
+    std::filesystem::create_directories(options.golden_dir);
+  auto baselines_path = options.golden_dir + "/timings.tsv";
+  auto baselines = read_baselines(baselines_path);
+  std::vector<CaseResult> results;
+  int n_failed = 0;
+  for (int i(0); i < cases.size(); i++) {
+    const auto &c = cases[i];
+    Backend::set_thread_budget(c.n_threads, 0);
+    auto result = run_case(options, c, case_paths[i]);
+
+    auto key = case_key(c);
+    if (options.update) {
+      if (result.error.empty())
+        baselines[key] = result.rtf;
+    } else if (baselines.count(key) && result.error.empty()) {
+      result.baseline_rtf = baselines[key];
+      result.rtf_regression =
+          result.rtf < result.baseline_rtf * (1 - options.rtf_tolerance);
+    }
+    n_failed += result.failed();
+
+    std::cout << (result.failed() ? "FAIL " : "ok   ") << key << ": rtf "
+              << result.rtf;
+    if (result.baseline_rtf > 0)
+      std::cout << " (baseline " << result.baseline_rtf << ")";
+    std::cout << ", golden " << result.golden << ", "
+              << result.allocations << " allocation(s) per call";
+    if (result.error.size())
+      std::cout << ", " << result.error;
+    std::cout << std::endl;
+    results.push_back(result);
+  }
+
+  if (options.update)
+    write_baselines(baselines_path, baselines);
+  if (options.report_path.size())
+    write_report(options.report_path, cases, results);
+  std::cout << cases.size() - n_failed << " case(s) passed, " << n_failed
+            << " failed" << std::endl;
+  return n_failed ? 1 : 0;
+}
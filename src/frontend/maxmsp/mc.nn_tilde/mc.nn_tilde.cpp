@@ -1,10 +1,13 @@
 #include "../../../backend/backend.h"
+#include "../../../backend/dsp_utils.h"
+#include "../../../backend/thread_pool.h"
 #include "../shared/circular_buffer.h"
+#include "../shared/pipeline.h"
 #include "c74_min.h"
-#include <chrono>
-#include <semaphore>
+#include <algorithm>
+#include <atomic>
+#include <numeric>
 #include <string>
-#include <thread>
 #include <vector>
 
 #ifndef VERSION
@@ -23,10 +26,24 @@ unsigned power_ceil(unsigned x) {
   return power;
 }
 
+unsigned ratio_ceil(unsigned x, unsigned ratio) {
+  return std::max(1u, (x + ratio - 1) / ratio) * ratio;
+}
+
 long simplemc_multichanneloutputs(c74::max::t_object *x, long index,
                                   long count);
 long simplemc_inputchanged(c74::max::t_object *x, long index, long count);
 
+// BUFFERS FOR A NUMBER OF VOICES, BUILT ON THE STRAND AND SWAPPED IN BY THE
+// PERFORM ROUTINE
+struct mc_nn_tilde_buffers {
+  int generation, max_batches, batches;
+  std::unique_ptr<std::atomic<bool>[]> voice_enabled;
+  std::unique_ptr<circular_buffer<double, float>[]> in_buffer;
+  std::unique_ptr<circular_buffer<float, double>[]> out_buffer;
+  std::unique_ptr<buffer_pipeline> pipeline;
+};
+
 class mc_nn_tilde : public object<mc_nn_tilde>, public mc_operator<> {
 public:
   MIN_DESCRIPTION{"Multi-channel interface for deep learning models"};
@@ -39,6 +56,8 @@ public:
   // INLETS OUTLETS
   std::vector<std::unique_ptr<inlet<>>> m_inlets;
   std::vector<std::unique_ptr<outlet<>>> m_outlets;
+  std::unique_ptr<outlet<thread_check::scheduler, thread_action::fifo>>
+      m_info_outlet;
 
   // CHANNELS
   std::vector<int> chans;
@@ -48,33 +67,68 @@ public:
   // BACKEND RELATED MEMBERS
   std::unique_ptr<Backend> m_model;
   std::string m_method;
+  int m_method_id;
   std::vector<std::string> settable_attributes;
   bool has_settable_attribute(std::string attribute);
   c74::min::path m_path;
   int m_in_dim, m_in_ratio, m_out_dim, m_out_ratio, m_higher_ratio;
-
-  // BUFFER RELATED MEMBERS
+  int m_batches; // voices, i.e. the smallest channel count of the inlets
+  int m_max_batches; // voices the buffers are allocated for
+  std::atomic<int> m_requested_batches{1}; // applied by the audio thread
+  std::unique_ptr<std::atomic<bool>[]> m_voice_enabled; // see "voice"
+  // VOICE STATES OF THE LAST RESET, WRITTEN BY THE "voice" MESSAGE AND READ
+  // BY THE AUDIO THREAD ONCE SWAPPED IN
+  std::atomic<bool> *m_voice_states = nullptr;
+  void set_active_batches(int n_batches);
+
+  // BUFFER RELATED MEMBERS. EVERY VOICE AND CHANNEL IS STORED PLANAR, AS
+  // [batch, channel, time], IN THE CIRCULAR BUFFERS, THE PIPELINE SLOTS AND
+  // THE MODEL INPUT TENSOR ALIKE
   int m_buffer_size;
   std::unique_ptr<circular_buffer<double, float>[]> m_in_buffer;
   std::unique_ptr<circular_buffer<float, double>[]> m_out_buffer;
-  std::vector<std::unique_ptr<float[]>> m_in_model, m_out_model;
+  std::unique_ptr<buffer_pipeline> m_pipeline;
   void reset_buffers();
 
+  // BUFFERS WAITING FOR THE NEXT PERFORM. THE MODEL IS NOT CALLED UNTIL THE
+  // BUFFERS OF THE LAST RESET ARE IN USE
+  std::atomic<mc_nn_tilde_buffers *> m_next_buffers{nullptr};
+  std::atomic<int> m_reset_generation{0};
+  int m_live_generation = 0, m_live_max_batches = 0;
+  mc_nn_tilde_buffers *build_buffers(int generation, int max_batches,
+                                     int batches, int n_warmup,
+                                     std::atomic<bool> *voice_enabled);
+  void swap_buffers();
+
   // AUDIO PERFORM
-  bool m_use_thread, m_should_stop_perform_thread;
-  std::unique_ptr<std::thread> m_compute_thread;
-  std::binary_semaphore m_data_available_lock, m_result_available_lock;
+  bool m_use_thread;
+  Strand m_compute_strand;
 
   void operator()(audio_bundle input, audio_bundle output);
   void perform(audio_bundle input, audio_bundle output);
+  void perform_buffer();
+  int m_dsp_vec_size = 0;
+
+  // PERIODIC STATS, SENT THROUGH THE NOTIFICATION OUTLET
+  void send_stats();
+  timer<> m_stats_timer{
+      this, [this](const c74::min::atoms &args,
+                   const int inlet) -> c74::min::atoms {
+        send_stats();
+        if (stats_interval > 0)
+          m_stats_timer.delay(stats_interval);
+        return {};
+      }};
 
   // using mc_operator::operator();
 
   // ONLY FOR DOCUMENTATION
   argument<symbol> path_arg{this, "model path",
                             "Absolute path to the pretrained model."};
-  argument<symbol> method_arg{this, "method",
-                              "Name of the method to call during synthesis."};
+  argument<symbol> method_arg{
+      this, "method",
+      "Name of the method to call during synthesis, or several methods "
+      "chained with > (e.g. encode>decode)."};
   argument<int> buffer_arg{
       this, "buffer size",
       "Size of the internal buffer (can't be lower than the method's ratio)."};
@@ -83,6 +137,132 @@ public:
   attribute<bool> enable{this, "enable", true,
                          description{"Enable / disable tensor computation"}};
 
+  // SILENCE GATE ATTRIBUTE
+  attribute<number> gate{
+      this, "gate", 0.,
+      description{"Voices whose input peak stays below this amplitude during "
+                  "a whole buffer output silence (0 to disable). Voices keep "
+                  "their batch index, the gated ones after the last active "
+                  "voice are left out of the model call."}};
+
+  // OUTPUT INTERPOLATION ATTRIBUTE
+  attribute<bool> interpolate{
+      this, "interpolate", false,
+      description{"Linearly interpolate (instead of hold) downsampled outputs"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_model)
+          m_model->use_linear_interpolation(bool(args[0]));
+        return args;
+      }}};
+
+  // CROSS-INSTANCE BATCHING ATTRIBUTE
+  attribute<bool> batching{
+      this, "batching", false,
+      description{"Batch computation with the other objects running the same "
+                  "model, method and buffer size (threaded mode only)"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_model)
+          m_model->use_batching(bool(args[0]) && m_use_thread);
+        return args;
+      }}};
+
+  // BUFFER SIZE OVERRIDE ATTRIBUTE
+  attribute<int> block_size{
+      this, "block_size", 0,
+      description{"Run the model on blocks of exactly this many samples "
+                  "(rounded up to the model ratio rather than to a power of "
+                  "two), overriding the buffer size argument, set at "
+                  "creation"}};
+
+  // LOAD TIME OPTIMIZATION ATTRIBUTES
+  attribute<int> optimize{
+      this, "optimize", 0,
+      description{"Graph optimization applied when loading the model: 0 for "
+                  "none, 1 to freeze it, 2 to freeze it and apply the "
+                  "inference passes, set at creation"},
+      range{0, 2}};
+
+  attribute<int> warmup{
+      this, "warmup", 2,
+      description{"Number of calls run on silence after (re)loading the "
+                  "model, so that the first buffers are as fast as the next "
+                  "ones, set at creation"}};
+
+  attribute<symbol> device{
+      this, "device", "cpu",
+      description{"Device running the model: cpu, cuda, cuda:<index>, mps, "
+                  "or auto to balance the objects across the accelerators"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_model && m_model->set_device(std::string(args[0])))
+          return {};
+        return args;
+      }}};
+
+  attribute<symbol> precision{
+      this, "precision", "fp32",
+      description{"Numerical precision of the model: fp32, fp16 or bf16 "
+                  "(models exported with quantized layers run them in int8), "
+                  "set at creation"},
+      range{"fp32", "fp16", "bf16"}};
+
+  attribute<bool> cache{
+      this, "cache", true,
+      description{"Keep the optimized or converted models in an on-disk "
+                  "cache, so that the next loads skip these passes. "
+                  "Disabling it affects every object, set at creation"}};
+
+  attribute<bool> profiling{
+      this, "profiling", true,
+      description{"Use the profiling graph executor, disabling it affects "
+                  "every object, set at creation"}};
+
+  // VOICE ALLOCATION ATTRIBUTE
+  attribute<int> max_batches{
+      this, "max_batches", 16,
+      description{"Number of voices allocated, so that changing the channel "
+                  "count of the inputs does not reallocate (nor interrupt) "
+                  "the other voices, set at creation"}};
+
+  // INPUT DECIMATION ATTRIBUTE
+  attribute<bool> average{
+      this, "average", false,
+      description{"Average the inputs over each model frame (box filter) "
+                  "instead of keeping one sample per ratio"}};
+
+  // INTRA-OP THREAD BUDGET ATTRIBUTE
+  attribute<int> threads{
+      this, "threads", 0,
+      description{"Maximum number of threads used inside each model call, 0 "
+                  "for the global budget (see the torch_threads message)"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_model)
+          m_model->set_intra_op_threads(int(args[0]));
+        return args;
+      }}};
+
+  // STATS ATTRIBUTE
+  attribute<int> stats_interval{
+      this, "stats_interval", 0,
+      description{"Period (in ms) at which timing statistics are sent through "
+                  "the notification outlet, 0 to disable"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_model && int(args[0]) > 0)
+          m_stats_timer.delay(int(args[0]));
+        return args;
+      }}};
+
+  // PIPELINE DEPTH ATTRIBUTE
+  attribute<int> pipeline{
+      this, "pipeline", 1,
+      description{"Number of buffers computed concurrently (threaded mode "
+                  "only), each one adds a buffer of latency"},
+      range{1, max_pipeline_size}};
+
   // BOOT STAMP
   message<> maxclass_setup{
       this, "maxclass_setup",
@@ -104,7 +284,11 @@ public:
   message<> anything{this, "anything", "callback for attributes",
                      MIN_FUNCTION{symbol attribute_name = args[0];
   if (attribute_name == "reload") {
-    m_model->reload();
+    // THE CURRENT MODEL KEEPS RUNNING UNTIL THE NEW ONE IS READY
+    m_model->reload_async([this](int return_code) {
+      if (m_info_outlet)
+        m_info_outlet->send("loaded", int(!return_code));
+    });
   } else if (attribute_name == "get_attributes") {
     for (std::string attr : settable_attributes) {
       cout << attr << endl;
@@ -114,6 +298,59 @@ public:
     for (std::string method : m_model->get_available_methods())
       cout << method << endl;
     return {};
+  } else if (attribute_name == "get_skipped") {
+    cout << "skipped buffers: "
+         << m_model->get_stats().get_deadline_misses() << endl;
+    return {};
+  } else if (attribute_name == "voice") {
+    // voice index state, DISABLED VOICES ARE NOT COMPUTED AND OUTPUT SILENCE
+    if (!m_voice_states || args.size() < 3 || int(args[1]) < 0 ||
+        int(args[1]) >= m_max_batches) {
+      cerr << "voice needs an index below " << m_max_batches << " and a state"
+           << endl;
+      return {};
+    }
+    m_voice_states[int(args[1])] = bool(int(args[2]));
+    return {};
+  } else if (attribute_name == "get_device") {
+    // THE DEVICE CHOSEN BY THE AUTOMATIC PLACEMENT
+    cout << "device: " << m_model->get_device() << endl;
+    return {};
+  } else if (attribute_name == "get_precision") {
+    // THE REQUESTED PRECISION MAY NOT BE SUPPORTED BY THE MODEL
+    cout << "precision: " << m_model->get_precision() << endl;
+    return {};
+  } else if (attribute_name == "stats") {
+    // stats [reset]
+    if (args.size() > 1 && std::string(args[1]) == "reset") {
+      m_model->get_stats().reset();
+      return {};
+    }
+    for (const auto &line : m_model->get_stats().format())
+      cout << line << endl;
+    return {};
+  } else if (attribute_name == "pool") {
+    // pool [threads [priority [core ...]]]
+    if (args.size() < 2) {
+      cout << "compute pool: " << ComputePool::get().get_num_threads()
+           << " threads" << endl;
+      return {};
+    }
+    std::vector<int> affinity;
+    for (int i(3); i < args.size(); i++)
+      affinity.push_back(int(args[i]));
+    ComputePool::get().configure(
+        int(args[1]), args.size() > 2 ? int(args[2]) : 0, affinity);
+  } else if (attribute_name == "torch_threads") {
+    // torch_threads [intra-op [inter-op]], FOR THE WHOLE PROCESS
+    if (args.size() < 2) {
+      auto budget = Backend::get_thread_budget();
+      cout << "torch threads: " << budget[0] << " intra-op, " << budget[1]
+           << " inter-op" << endl;
+      return {};
+    }
+    Backend::set_thread_budget(int(args[1]),
+                               args.size() > 2 ? int(args[2]) : 0);
   } else if (attribute_name == "get") {
     if (args.size() < 2) {
       cerr << "get must be given an attribute name" << endl;
@@ -140,7 +377,16 @@ public:
         attribute_args.push_back(args[i]);
       }
       try {
-        m_model->set_attribute(attribute_name, attribute_args);
+        // A SINGLE NUMBER TAKES THE TYPED PATH, WITHOUT ANY STRING
+        auto float_id = m_model->get_float_attribute_id(attribute_name);
+        if (float_id >= 0 && args.size() == 3 &&
+            args[2].a_type != c74::max::A_SYM)
+          m_model->set_float_attribute(float_id, float(args[2]));
+        else
+          m_model->set_attribute(attribute_name, attribute_args);
+        // APPLIED BETWEEN TWO BUFFERS, EVEN WHEN THE DSP IS OFF
+        m_compute_strand.submit(
+            [this] { m_model->apply_attribute_commands(); });
       } catch (std::string message) {
         cerr << message << endl;
       }
@@ -161,62 +407,50 @@ int mc_nn_tilde::get_batches() {
   return *std::min_element(chans.begin(), chans.end());
 }
 
-void model_perform(mc_nn_tilde *mc_nn_instance) {
-  std::vector<float *> in_model, out_model;
-
-  for (auto &ptr : mc_nn_instance->m_in_model)
-    in_model.push_back(ptr.get());
-
-  for (auto &ptr : mc_nn_instance->m_out_model)
-    out_model.push_back(ptr.get());
-
-  mc_nn_instance->m_model->perform(
-      in_model, out_model, mc_nn_instance->m_buffer_size,
-      mc_nn_instance->m_method, mc_nn_instance->get_batches());
-}
-
-void check_loop_buffers(mc_nn_tilde *mc_nn_instance, std::vector<float *> &in_model, std::vector<float *> &out_model) {
-  if (mc_nn_instance->m_in_model.size() != in_model.size())
-  {
-    in_model.clear();
-    for (auto &ptr : mc_nn_instance->m_in_model)
-      in_model.push_back(ptr.get());
-
-  }
-  if (mc_nn_instance->m_out_model.size() != out_model.size())
-  {
-    out_model.clear();
-    for (auto &ptr : mc_nn_instance->m_out_model)
-      out_model.push_back(ptr.get());
+void model_perform(mc_nn_tilde *mc_nn_instance,
+                   buffer_pipeline::slot *slot) {
+  // EACH SLOT REMEMBERS THE NUMBER OF VOICES IT WAS FILLED WITH
+  int n_batches = slot->output.size() / mc_nn_instance->m_out_dim;
+
+  // THE BACKEND COPIES THE SLOT INTO THE MODEL INPUT TENSOR, BOTH INDEXED BY
+  // batch * in_dim + channel
+  auto in_dim = mc_nn_instance->m_in_dim;
+  auto out_dim = mc_nn_instance->m_out_dim;
+  if (slot->active.size() == n_batches) {
+    mc_nn_instance->m_model->perform_prepared(
+        slot->input, slot->output, mc_nn_instance->m_buffer_size,
+        mc_nn_instance->m_method_id, n_batches);
+    return;
   }
-}
 
-void model_perform_loop(mc_nn_tilde *mc_nn_instance) {
-  std::vector<float *> in_model, out_model;
-
-  for (auto &ptr : mc_nn_instance->m_in_model)
-    in_model.push_back(ptr.get());
-
-  for (auto &ptr : mc_nn_instance->m_out_model)
-    out_model.push_back(ptr.get());
-
-  while (!mc_nn_instance->m_should_stop_perform_thread) {
-    check_loop_buffers(mc_nn_instance, in_model, out_model);
-    if (mc_nn_instance->m_data_available_lock.try_acquire_for(
-            std::chrono::milliseconds(200))) {
-      mc_nn_instance->m_model->perform(
-          in_model, out_model, mc_nn_instance->m_buffer_size,
-          mc_nn_instance->m_method, mc_nn_instance->get_batches());
-      mc_nn_instance->m_result_available_lock.release();
+  // A VOICE KEEPS ITS BATCH INDEX, SO THAT THE STATE OF A STREAMING MODEL
+  // STAYS WITH IT. ONLY THE GATED VOICES AFTER THE LAST ACTIVE ONE ARE LEFT
+  // OUT OF THE CALL, THE OTHER GATED ONES RUN AND ARE SILENCED AFTERWARDS
+  int n_run = slot->active.size() ? slot->active.back() + 1 : 0;
+  slot->active_input.assign(slot->input.begin(),
+                            slot->input.begin() + n_run * in_dim);
+  slot->active_output.assign(slot->output.begin(),
+                             slot->output.begin() + n_run * out_dim);
+  if (n_run)
+    mc_nn_instance->m_model->perform_prepared(
+        slot->active_input, slot->active_output,
+        mc_nn_instance->m_buffer_size, mc_nn_instance->m_method_id, n_run);
+  for (int b(0), k(0); b < n_batches; b++) {
+    if (k < slot->active.size() && slot->active[k] == b) {
+      k++;
+      continue;
     }
+    for (int d(0); d < out_dim; d++)
+      std::fill_n(slot->output[b * out_dim + d],
+                  mc_nn_instance->m_buffer_size, 0.f);
   }
 }
 
 mc_nn_tilde::mc_nn_tilde(const atoms &args)
-    : m_compute_thread(nullptr), m_in_dim(1), m_in_ratio(1), m_out_dim(1),
-      m_out_ratio(1), m_buffer_size(4096), m_method("forward"),
-      m_use_thread(true), m_data_available_lock(0), m_result_available_lock(1),
-      m_should_stop_perform_thread(false) {
+    : m_in_dim(1), m_in_ratio(1), m_out_dim(1), m_out_ratio(1), m_batches(1),
+      m_max_batches(1),
+      m_buffer_size(4096), m_method("forward"), m_method_id(-1),
+      m_use_thread(true) {
   m_model = std::make_unique<Backend>();
   // CHECK ARGUMENTS
   if (!args.size()) {
@@ -235,6 +469,14 @@ mc_nn_tilde::mc_nn_tilde(const atoms &args)
     m_buffer_size = int(args[2]);
   }
 
+  m_model->set_optimization_level(optimize);
+  m_model->set_precision(std::string(precision));
+  m_model->set_device(std::string(device));
+  if (!profiling)
+    Backend::use_profiling_executor(false);
+  if (!cache)
+    Backend::use_model_cache(false);
+
   // TRY TO LOAD MODEL
   if (m_model->load(std::string(m_path))) {
     cerr << "error during loading" << endl;
@@ -242,6 +484,9 @@ mc_nn_tilde::mc_nn_tilde(const atoms &args)
     return;
   }
 
+  m_model->use_linear_interpolation(interpolate);
+  m_model->set_intra_op_threads(threads);
+
   // FIND MINIMUM BUFFER SIZE GIVEN MODEL RATIO
   m_higher_ratio = 1;
   auto model_methods = m_model->get_available_methods();
@@ -254,6 +499,7 @@ mc_nn_tilde::mc_nn_tilde(const atoms &args)
   }
 
   // GET MODEL'S METHOD PARAMETERS
+  m_method_id = m_model->get_method_id(m_method);
   auto params = m_model->get_method_params(m_method);
 
   try {
@@ -283,53 +529,65 @@ mc_nn_tilde::mc_nn_tilde(const atoms &args)
     m_buffer_size = power_ceil(m_buffer_size);
   }
 
+  // THE MODEL RUNS ON BLOCKS SMALLER THAN A POWER OF TWO
+  if (block_size > 0)
+    m_buffer_size = ratio_ceil(block_size, m_higher_ratio);
+
 // Calling forward in a thread causes memory leak in windows.
 // See https://github.com/pytorch/pytorch/issues/24237
 #ifdef _WIN32
   m_use_thread = false;
 #endif
 
-  // CREATE INLETS, OUTLETS and BUFFERS
-  m_in_buffer = std::make_unique<circular_buffer<double, float>[]>(
-      m_in_dim * get_batches());
-  for (int i(0); i < m_in_dim * get_batches(); i++) {
+  m_model->use_batching(batching && m_use_thread);
+
+  // CREATE INLETS AND OUTLETS
+  auto descriptor = m_model->get_method_descriptor(m_method_id);
+  for (int i(0); i < m_in_dim; i++) {
     std::string input_label = "";
     try {
-      input_label = m_model->get_model()
-                        .attr(m_method + "_input_labels")
-                        .toList()
-                        .get(i)
-                        .toStringRef();
+      input_label = descriptor->input_labels.at(i);
     } catch (...) {
       input_label = "(signal) model input " + std::to_string(i);
     }
     m_inlets.push_back(
         std::make_unique<inlet<>>(this, input_label, "multichannelsignal"));
-    m_in_buffer[i].initialize(m_buffer_size);
-    m_in_model.push_back(std::make_unique<float[]>(m_buffer_size));
   }
-
-  m_out_buffer = std::make_unique<circular_buffer<float, double>[]>(
-      m_out_dim * get_batches());
-  for (int i(0); i < m_out_dim * get_batches(); i++) {
+  for (int i(0); i < m_out_dim; i++) {
     std::string output_label = "";
     try {
-      output_label = m_model->get_model()
-                         .attr(m_method + "_output_labels")
-                         .toList()
-                         .get(i)
-                         .toStringRef();
+      output_label = descriptor->output_labels.at(i);
     } catch (...) {
       output_label = "(signal) model output " + std::to_string(i);
     }
     m_outlets.push_back(
         std::make_unique<outlet<>>(this, output_label, "multichannelsignal"));
-    m_out_buffer[i].initialize(m_buffer_size);
-    m_out_model.push_back(std::make_unique<float[]>(m_buffer_size));
   }
 
-  if (m_use_thread)
-    m_compute_thread = std::make_unique<std::thread>(model_perform_loop, this);
+  // ALLOCATE THE MODEL INPUT TENSOR AND THE BUFFERS OF EVERY VOICE, THE DSP
+  // IS NOT RUNNING YET SO THEY ARE PUT IN USE RIGHT AWAY
+  reset_buffers();
+  m_compute_strand.wait();
+  swap_buffers();
+
+  // NOTIFICATIONS, SENT FROM THE LOADING THREAD AND DEFERRED TO THE SCHEDULER
+  m_info_outlet = std::make_unique<
+      outlet<thread_check::scheduler, thread_action::fifo>>(
+      this, "(anything) notifications");
+  if (stats_interval > 0)
+    m_stats_timer.delay(stats_interval);
+}
+
+void mc_nn_tilde::send_stats() {
+  if (!m_info_outlet || !m_model)
+    return;
+  auto &stats = m_model->get_stats();
+  for (const auto &stage : stats.get_stage_stats())
+    m_info_outlet->send("stats", stage.name, int(stage.count), stage.p50,
+                        stage.p95, stage.p99);
+  m_info_outlet->send("stats", "misses", stats.get_deadline_misses());
+  m_info_outlet->send("stats", "queue", stats.get_mean_queue_depth(),
+                      stats.get_max_queue_depth());
 }
 
 bool mc_nn_tilde::has_settable_attribute(std::string attribute) {
@@ -340,28 +598,110 @@ bool mc_nn_tilde::has_settable_attribute(std::string attribute) {
   return false;
 }
 
+// ALLOCATES THE BUFFERS OF EVERY VOICE, AND WARMS THE MODEL UP FOR THEM.
+// RUNS ON THE STRAND, AFTER THE BUFFERS IN FLIGHT
+mc_nn_tilde_buffers *
+mc_nn_tilde::build_buffers(int generation, int max_batches, int batches,
+                           int n_warmup,
+                           std::atomic<bool> *voice_enabled) {
+  // THE MODEL INPUT TENSOR IS ALLOCATED ONCE FOR EVERY VOICE, FILLED FROM THE
+  // SLOTS DURING PERFORM. FEWER VOICES ONLY RUN THE MODEL ON ITS FIRST BATCHES.
+  m_model->prepare(m_method_id, m_buffer_size, max_batches);
+  m_model->set_warmup(n_warmup, m_buffer_size, batches);
+
+  auto n_in = m_in_dim * max_batches, n_out = m_out_dim * max_batches;
+  auto buffers = new mc_nn_tilde_buffers;
+  buffers->generation = generation;
+  buffers->max_batches = max_batches;
+  buffers->batches = batches;
+  buffers->voice_enabled.reset(voice_enabled);
+  buffers->in_buffer =
+      std::make_unique<circular_buffer<double, float>[]>(n_in);
+  for (int i(0); i < n_in; i++)
+    buffers->in_buffer[i].initialize(m_buffer_size);
+  buffers->out_buffer =
+      std::make_unique<circular_buffer<float, double>[]>(n_out);
+  for (int i(0); i < n_out; i++)
+    buffers->out_buffer[i].initialize(2 * m_buffer_size);
+  buffers->pipeline = std::make_unique<buffer_pipeline>();
+  buffers->pipeline->initialize(m_use_thread ? max_pipeline_size : 1, n_in,
+                                m_buffer_size / m_in_ratio, n_out,
+                                m_buffer_size);
+  return buffers;
+}
+
+// CALLED BY PERFORM, PUTS THE BUFFERS OF THE LAST RESET IN USE
+void mc_nn_tilde::swap_buffers() {
+  auto buffers = m_next_buffers.exchange(nullptr);
+  if (!buffers)
+    return;
+  m_live_generation = buffers->generation;
+  m_live_max_batches = buffers->max_batches;
+  m_batches = buffers->batches;
+  std::swap(m_voice_enabled, buffers->voice_enabled);
+  std::swap(m_in_buffer, buffers->in_buffer);
+  std::swap(m_out_buffer, buffers->out_buffer);
+  std::swap(m_pipeline, buffers->pipeline);
+  m_dsp_vec_size = 0; // PRIMES THE NEW OUTPUT BUFFERS
+
+  // NO BUFFER IS SUBMITTED WHILE A RESET IS PENDING, SO THE PREVIOUS BUFFERS
+  // ARE IDLE. THEY ARE RELEASED ON THE STRAND RATHER THAN IN PERFORM
+  if (!m_compute_strand.submit([buffers] { delete buffers; }))
+    delete buffers;
+}
+
+// REBUILDS THE BUFFERS FOR MORE VOICES WITHOUT BLOCKING THE MAIN THREAD NOR
+// TOUCHING THE ONES IN USE, THEY ARE SWAPPED IN AT THE NEXT PERFORM
 void mc_nn_tilde::reset_buffers() {
-  auto params = m_model->get_method_params(m_method);
-  m_in_dim = params[0] * get_batches();
-  m_out_dim = params[2] * get_batches();
-  m_in_buffer = std::make_unique<circular_buffer<double, float>[]>(m_in_dim);
-  m_out_buffer = std::make_unique<circular_buffer<float, double>[]>(m_out_dim);
-  m_in_model.clear();
-  m_out_model.clear();
-  for (int i(0); i < m_in_dim; i++) {
-    m_in_buffer[i].initialize(m_buffer_size);
-    m_in_model.push_back(std::make_unique<float[]>(m_buffer_size));
+  auto previous_max_batches = m_max_batches;
+  auto batches = get_batches();
+  auto max_batches_now = std::max(int(max_batches), batches);
+
+  // VOICE STATES SURVIVE THE REALLOCATION
+  auto voice_enabled = new std::atomic<bool>[max_batches_now];
+  for (int b(0); b < max_batches_now; b++)
+    voice_enabled[b] = !m_voice_states || b >= previous_max_batches ||
+                       m_voice_states[b];
+
+  auto generation = ++m_reset_generation;
+  int n_warmup = warmup;
+  if (!m_compute_strand.submit([=] {
+        auto buffers = build_buffers(generation, max_batches_now, batches,
+                                     n_warmup, voice_enabled);
+        // BUFFERS OF A PREVIOUS RESET THAT WERE NEVER SWAPPED IN ARE DROPPED
+        delete m_next_buffers.exchange(buffers);
+      })) {
+    m_reset_generation--;
+    delete[] voice_enabled;
+    cerr << "compute queue full, buffers not reset" << endl;
+    return;
   }
-  for (int i(0); i < m_out_dim; i++) {
-    m_out_buffer[i].initialize(m_buffer_size);
-    m_out_model.push_back(std::make_unique<float[]>(m_buffer_size));
+  // THE STATES OF THE PREVIOUS RESET ARE ONLY FREED ONCE THESE ARE SWAPPED IN
+  m_voice_states = voice_enabled;
+  m_max_batches = max_batches_now;
+  m_requested_batches = batches;
+}
+
+// FROM THE AUDIO THREAD. VOICES KEEP THEIR BUFFERED SAMPLES, THE ONES ADDED
+// START WITH SILENCE, ALIGNED WITH THE OTHER VOICES
+void mc_nn_tilde::set_active_batches(int n_batches) {
+  for (int c(m_in_dim * m_batches); c < m_in_dim * n_batches; c++) {
+    m_in_buffer[c].reset();
+    m_in_buffer[c].prime(int(m_in_buffer[0].available()));
   }
+  for (int c(m_out_dim * m_batches); c < m_out_dim * n_batches; c++) {
+    m_out_buffer[c].reset();
+    m_out_buffer[c].prime(int(m_out_buffer[0].available()));
+  }
+  m_batches = n_batches;
 }
 
 mc_nn_tilde::~mc_nn_tilde() {
-  m_should_stop_perform_thread = true;
-  if (m_compute_thread)
-    m_compute_thread->join();
+  // THE RELOAD CALLBACK USES MEMBERS DESTROYED BEFORE m_model
+  m_model->wait_for_load();
+  // WAIT FOR THE LAST COMPUTATION SUBMITTED TO THE POOL
+  m_compute_strand.wait();
+  delete m_next_buffers.exchange(nullptr);
 }
 
 void fill_with_zero(audio_bundle output) {
@@ -383,74 +723,146 @@ bool mc_nn_tilde::check_inputs() {
 }
 
 void mc_nn_tilde::operator()(audio_bundle input, audio_bundle output) {
-  auto dsp_vec_size = output.frame_count();
-
   // CHECK IF MODEL IS LOADED AND ENABLED
   if (!m_model->is_loaded() || !enable) {
     fill_with_zero(output);
     return;
   }
 
-  // CHECK IF DSP_VEC_SIZE IS LARGER THAN BUFFER SIZE
-  if (dsp_vec_size > m_buffer_size) {
-    cerr << "vector size (" << dsp_vec_size << ") ";
-    cerr << "larger than buffer size (" << m_buffer_size << "). ";
-    cerr << "disabling model.";
-    cerr << endl;
-    enable = false;
+  perform(input, output);
+}
+
+void mc_nn_tilde::perform(audio_bundle input, audio_bundle output) {
+  int vec_size = input.frame_count();
+
+  swap_buffers();
+
+  // THE BUFFERS OF THE NEW VOICES ARE STILL BEING BUILT
+  auto n_batches = m_requested_batches.load(std::memory_order_relaxed);
+  if (n_batches > m_live_max_batches) {
     fill_with_zero(output);
     return;
   }
+  if (n_batches != m_batches)
+    set_active_batches(n_batches);
+
+  // DELAY THE OUTPUT SO THAT IT NEVER UNDERRUNS WHEN THE BUFFER AND THE VECTOR
+  // SIZE ARE NOT MULTIPLES OF EACH OTHER
+  if (vec_size != m_dsp_vec_size) {
+    m_dsp_vec_size = vec_size;
+    for (int c(0); c < m_out_dim * m_batches; c++) {
+      m_out_buffer[c].reset();
+      m_out_buffer[c].prime(m_buffer_size - std::gcd(vec_size, m_buffer_size));
+    }
+  }
 
-  perform(input, output);
-}
+  // PROCESS THE VECTOR IN CHUNKS ENDING ON BUFFER BOUNDARIES
+  for (int offset(0), n(0); offset < vec_size; offset += n) {
+    n = std::min(vec_size - offset,
+                 m_buffer_size - int(m_in_buffer[0].available()));
+
+    // COPY INPUT TO CIRCULAR BUFFER. INLET i CARRIES chans[i] CHANNELS, THE
+    // FIRST m_batches OF THEM BEING THE VOICES OF THE MODEL.
+    int dim_offset = 0;
+    for (int i(0); i < m_in_dim; i++) {
+      for (int b(0); b < m_batches; b++) {
+        auto in = input.samples(dim_offset + b) + offset;
+        m_in_buffer[b * m_in_dim + i].put(in, n);
+      }
+      dim_offset += chans[i];
+    }
 
-void mc_nn_tilde::perform(audio_bundle input, audio_bundle output) {
-  auto vec_size = input.frame_count();
-
-  // COPY INPUT TO CIRCULAR BUFFER
-  int dim_offset = 0;
-  for (int i(0); i < m_inlets.size(); i++) {
-    for (int b(0); b < get_batches(); b++) {
-      auto in = input.samples(dim_offset + b);
-      m_in_buffer[i * get_batches() + b].put(in, vec_size);
+    if (m_in_buffer[0].full()) // BUFFER IS FULL
+      perform_buffer();
+
+    // COPY CIRCULAR BUFFER TO OUTPUT, OUTLET d CARRYING m_batches CHANNELS
+    for (int d(0); d < m_out_dim; d++) {
+      for (int b(0); b < m_batches; b++) {
+        auto out = output.samples(d * m_batches + b) + offset;
+        m_out_buffer[b * m_out_dim + d].get(out, n);
+      }
     }
-    dim_offset += chans[i];
   }
+}
 
-  if (m_in_buffer[0].full()) { // BUFFER IS FULL
-    if (!m_use_thread) {
-      // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_in_dim * get_batches(); c++)
-        m_in_buffer[c].get(m_in_model[c].get(), m_buffer_size);
+void mc_nn_tilde::perform_buffer() {
+  auto n_in = m_in_dim * m_batches, n_out = m_out_dim * m_batches;
 
-      // CALL MODEL PERFORM IN CURRENT THREAD
-      model_perform(this);
+  if (m_live_generation != m_reset_generation.load()) {
+    // THE BUFFERS ARE BEING REBUILT, THE MODEL IS LEFT TO THE STRAND
+    for (int c(0); c < n_in; c++)
+      m_in_buffer[c].reset();
+    for (int c(0); c < n_out; c++)
+      m_out_buffer[c].prime(m_buffer_size);
+    return;
+  }
 
-      // TRANSFER MEMORY BETWEEN OUTPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_out_dim; c++)
-        m_out_buffer[c].put(m_out_model[c].get(), m_buffer_size);
+  if (m_use_thread && m_pipeline->size() != pipeline)
+    m_pipeline->resize(pipeline);
 
-    } else if (m_result_available_lock.try_acquire()) {
-      // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_in_dim; c++)
-        m_in_buffer[c].get(m_in_model[c].get(), m_buffer_size);
+  auto slot = m_pipeline->current();
 
-      // TRANSFER MEMORY BETWEEN OUTPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_out_dim; c++)
-        m_out_buffer[c].put(m_out_model[c].get(), m_buffer_size);
+  if (slot->busy.load(std::memory_order_acquire)) {
+    // DEADLINE MISSED, SKIP THE BUFFER RATHER THAN WAITING FOR THE MODEL
+    for (int c(0); c < n_in; c++)
+      m_in_buffer[c].reset();
+    for (int c(0); c < n_out; c++)
+      m_out_buffer[c].prime(m_buffer_size);
+    m_model->get_stats().record_deadline_miss();
+    return;
+  }
 
-      // SIGNAL PERFORM THREAD THAT DATA IS AVAILABLE
-      m_data_available_lock.release();
-    }
+  // TRANSFER THE RESULT COMPUTED `pipeline` BUFFERS AGO, VOICES ADDED SINCE
+  // THEN START WITH SILENCE
+  for (int c(0); c < n_out; c++) {
+    if (slot->has_result && c < slot->output.size())
+      m_out_buffer[c].put(slot->output[c], m_buffer_size);
+    else if (m_use_thread)
+      m_out_buffer[c].prime(m_buffer_size);
   }
 
-  // COPY CIRCULAR BUFFER TO OUTPUT
-  for (int b(0); b < get_batches(); b++) {
-    for (int d(0); d < m_outlets.size(); d++) {
-      auto out = output.samples(d * get_batches() + b);
-      m_out_buffer[b * m_outlets.size() + d].get(out, vec_size);
+  // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND SLOT, AT THE MODEL RATE
+  m_pipeline->set_channels(slot, n_in, n_out);
+  for (int c(0); c < n_in; c++) {
+    if (average)
+      m_in_buffer[c].get_mean(slot->input[c], m_buffer_size, m_in_ratio);
+    else
+      m_in_buffer[c].get(slot->input[c], m_buffer_size, m_in_ratio);
+  }
+
+  // LEAVE THE DISABLED AND SILENT VOICES OUT OF THE MODEL CALL
+  float threshold = gate;
+  slot->active.clear();
+  for (int b(0); b < m_batches; b++) {
+    if (!m_voice_enabled[b].load(std::memory_order_relaxed))
+      continue;
+    if (threshold > 0 &&
+        peak_amplitude(slot->input[b * m_in_dim],
+                       m_in_dim * m_buffer_size / m_in_ratio) < threshold)
+      continue;
+    slot->active.push_back(b);
+  }
+
+  if (!m_use_thread) {
+    // CALL MODEL PERFORM IN CURRENT THREAD
+    model_perform(this, slot);
+    for (int c(0); c < n_out; c++)
+      m_out_buffer[c].put(slot->output[c], m_buffer_size);
+  } else {
+    // SUBMIT THE COMPUTATION TO THE SHARED POOL
+    m_model->get_stats().record_queue_depth(m_pipeline->in_flight());
+    slot->busy.store(true, std::memory_order_relaxed);
+    slot->has_result = true;
+    if (!m_compute_strand.submit([this, slot] {
+          model_perform(this, slot);
+          slot->busy.store(false, std::memory_order_release);
+        })) {
+      // THE STRAND IS FULL, THE BUFFER IS SKIPPED
+      slot->busy.store(false, std::memory_order_relaxed);
+      slot->has_result = false;
+      m_model->get_stats().record_deadline_miss();
     }
+    m_pipeline->advance();
   }
 }
 
@@ -467,8 +879,12 @@ long simplemc_inputchanged(c74::max::t_object *x, long index, long count) {
     auto old_n_batch = ob->m_min_object.get_batches();
     ob->m_min_object.chans[index] = count;
     auto new_n_batch = ob->m_min_object.get_batches();
-    if (old_n_batch != new_n_batch) {
+    // THE PREALLOCATED VOICES ARE ENABLED FROM THE AUDIO THREAD, ONLY A
+    // LARGER COUNT REALLOCATES THE BUFFERS
+    if (new_n_batch > ob->m_min_object.m_max_batches) {
       ob->m_min_object.reset_buffers();
+    } else if (old_n_batch != new_n_batch) {
+      ob->m_min_object.m_requested_batches = new_n_batch;
     }
     needs_refresh = true;
   }
@@ -1,10 +1,13 @@
 #include "../../../backend/backend.h"
+#include "../../../backend/offline_render.h"
+#include "../../../backend/thread_pool.h"
 #include "../shared/circular_buffer.h"
+#include "../shared/pipeline.h"
 #include "c74_min.h"
-#include <chrono>
-#include <semaphore>
+#include <algorithm>
+#include <atomic>
+#include <numeric>
 #include <string>
-#include <thread>
 #include <vector>
 
 #ifndef VERSION
@@ -23,6 +26,10 @@ unsigned power_ceil(unsigned x) {
   return power;
 }
 
+unsigned ratio_ceil(unsigned x, unsigned ratio) {
+  return std::max(1u, (x + ratio - 1) / ratio) * ratio;
+}
+
 class nn : public object<nn>, public vector_operator<> {
 public:
   MIN_DESCRIPTION{"Interface for deep learning models"};
@@ -35,11 +42,14 @@ public:
   // INLETS OUTLETS
   std::vector<std::unique_ptr<inlet<>>> m_inlets;
   std::vector<std::unique_ptr<outlet<>>> m_outlets;
+  std::unique_ptr<outlet<thread_check::scheduler, thread_action::fifo>>
+      m_info_outlet;
 
   // BACKEND RELATED MEMBERS
   std::unique_ptr<Backend> m_model;
   bool m_is_backend_init = false;
   std::string m_method;
+  int m_method_id;
   std::vector<std::string> settable_attributes;
   bool has_settable_attribute(std::string attribute);
   c74::min::path m_path;
@@ -49,21 +59,50 @@ public:
   int m_buffer_size;
   std::unique_ptr<circular_buffer<double, float>[]> m_in_buffer;
   std::unique_ptr<circular_buffer<float, double>[]> m_out_buffer;
-  std::vector<std::unique_ptr<float[]>> m_in_model, m_out_model;
+  buffer_pipeline m_pipeline;
+  std::atomic<int> m_signal_attribute{-1}; // float attribute id, see below
 
   // AUDIO PERFORM
-  bool m_use_thread, m_should_stop_perform_thread;
-  std::unique_ptr<std::thread> m_compute_thread;
-  std::binary_semaphore m_data_available_lock, m_result_available_lock;
+  bool m_use_thread;
+  Strand m_compute_strand;
 
   void operator()(audio_bundle input, audio_bundle output);
   void perform(audio_bundle input, audio_bundle output);
+  void perform_buffer();
+  int m_dsp_vec_size = 0;
+
+  // PERIODIC STATS, SENT THROUGH THE NOTIFICATION OUTLET
+  void send_stats();
+  timer<> m_stats_timer{
+      this, [this](const c74::min::atoms &args,
+                   const int inlet) -> c74::min::atoms {
+        send_stats();
+        if (stats_interval > 0)
+          m_stats_timer.delay(stats_interval);
+        return {};
+      }};
+
+  // OFFLINE RENDERING FROM AND TO BUFFER~ OBJECTS, POLLED FROM THE MAIN THREAD
+  OfflineRenderer m_renderer;
+  buffer_reference m_render_source{this, nullptr, false};
+  buffer_reference m_render_destination{this, nullptr, false};
+  void start_render(symbol source, symbol destination, int chunk_size,
+                    int n_batches);
+  void poll_render();
+  timer<timer_options::defer_delivery> m_render_timer{
+      this, [this](const c74::min::atoms &args,
+                   const int inlet) -> c74::min::atoms {
+        poll_render();
+        return {};
+      }};
 
   // ONLY FOR DOCUMENTATION
   argument<symbol> path_arg{this, "model path",
                             "Absolute path to the pretrained model."};
-  argument<symbol> method_arg{this, "method",
-                              "Name of the method to call during synthesis."};
+  argument<symbol> method_arg{
+      this, "method",
+      "Name of the method to call during synthesis, or several methods "
+      "chained with > (e.g. encode>decode)."};
   argument<int> buffer_arg{
       this, "buffer size",
       "Size of the internal buffer (can't be lower than the method's ratio)."};
@@ -72,16 +111,135 @@ public:
   attribute<bool> enable{this, "enable", true,
                          description{"Enable / disable tensor computation"}};
 
+  // SIGNAL DRIVEN ATTRIBUTE
+  attribute<symbol> signal_attribute{
+      this, "signal_attribute", "",
+      description{"Float attribute of the model driven by an extra rightmost "
+                  "signal inlet, sampled once per buffer, set at creation"}};
+
+  // OUTPUT INTERPOLATION ATTRIBUTE
+  attribute<bool> interpolate{
+      this, "interpolate", false,
+      description{"Linearly interpolate (instead of hold) downsampled outputs"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_is_backend_init)
+          m_model->use_linear_interpolation(bool(args[0]));
+        return args;
+      }}};
+
   // ENABLE / DISABLE ATTRIBUTE
   attribute<bool> gpu{this, "gpu", false,
                       description{"Enable / disable gpu usage when available"},
                       setter{[this](const c74::min::atoms &args,
                                     const int inlet) -> c74::min::atoms {
-                        if (m_is_backend_init)
+                        if (m_is_backend_init && std::string(device) == "")
                           m_model->use_gpu(bool(args[0]));
                         return args;
                       }}};
 
+  attribute<symbol> device{
+      this, "device", "",
+      description{"Device running the model: cpu, cuda, cuda:<index>, mps, "
+                  "or auto to balance the objects across the accelerators "
+                  "(overrides the gpu attribute when set)"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_is_backend_init && std::string(args[0]) != "" &&
+            m_model->set_device(std::string(args[0])))
+          return {};
+        return args;
+      }}};
+
+  // CROSS-INSTANCE BATCHING ATTRIBUTE
+  attribute<bool> batching{
+      this, "batching", false,
+      description{"Batch computation with the other objects running the same "
+                  "model, method and buffer size (threaded mode only)"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_is_backend_init)
+          m_model->use_batching(bool(args[0]) && m_use_thread);
+        return args;
+      }}};
+
+  // BUFFER SIZE OVERRIDE ATTRIBUTE
+  attribute<int> block_size{
+      this, "block_size", 0,
+      description{"Run the model on blocks of exactly this many samples "
+                  "(rounded up to the model ratio rather than to a power of "
+                  "two), overriding the buffer size argument, set at "
+                  "creation"}};
+
+  // LOAD TIME OPTIMIZATION ATTRIBUTES
+  attribute<int> optimize{
+      this, "optimize", 0,
+      description{"Graph optimization applied when loading the model: 0 for "
+                  "none, 1 to freeze it, 2 to freeze it and apply the "
+                  "inference passes, set at creation"},
+      range{0, 2}};
+
+  attribute<int> warmup{
+      this, "warmup", 2,
+      description{"Number of calls run on silence after (re)loading the "
+                  "model, so that the first buffers are as fast as the next "
+                  "ones, set at creation"}};
+
+  attribute<symbol> precision{
+      this, "precision", "fp32",
+      description{"Numerical precision of the model: fp32, fp16 or bf16 "
+                  "(models exported with quantized layers run them in int8), "
+                  "set at creation"},
+      range{"fp32", "fp16", "bf16"}};
+
+  attribute<bool> cache{
+      this, "cache", true,
+      description{"Keep the optimized or converted models in an on-disk "
+                  "cache, so that the next loads skip these passes. "
+                  "Disabling it affects every object, set at creation"}};
+
+  attribute<bool> profiling{
+      this, "profiling", true,
+      description{"Use the profiling graph executor, disabling it affects "
+                  "every object, set at creation"}};
+
+  // INPUT DECIMATION ATTRIBUTE
+  attribute<bool> average{
+      this, "average", false,
+      description{"Average the inputs over each model frame (box filter) "
+                  "instead of keeping one sample per ratio"}};
+
+  // INTRA-OP THREAD BUDGET ATTRIBUTE
+  attribute<int> threads{
+      this, "threads", 0,
+      description{"Maximum number of threads used inside each model call, 0 "
+                  "for the global budget (see the torch_threads message)"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_is_backend_init)
+          m_model->set_intra_op_threads(int(args[0]));
+        return args;
+      }}};
+
+  // STATS ATTRIBUTE
+  attribute<int> stats_interval{
+      this, "stats_interval", 0,
+      description{"Period (in ms) at which timing statistics are sent through "
+                  "the notification outlet, 0 to disable"},
+      setter{[this](const c74::min::atoms &args,
+                    const int inlet) -> c74::min::atoms {
+        if (m_is_backend_init && int(args[0]) > 0)
+          m_stats_timer.delay(int(args[0]));
+        return args;
+      }}};
+
+  // PIPELINE DEPTH ATTRIBUTE
+  attribute<int> pipeline{
+      this, "pipeline", 1,
+      description{"Number of buffers computed concurrently (threaded mode "
+                  "only), each one adds a buffer of latency"},
+      range{1, max_pipeline_size}};
+
   // BOOT STAMP
   message<> maxclass_setup{
       this, "maxclass_setup",
@@ -97,7 +255,15 @@ public:
       [this](const c74::min::atoms &args, const int inlet) -> c74::min::atoms {
         symbol attribute_name = args[0];
         if (attribute_name == "reload") {
-          m_model->reload();
+          // THE CURRENT MODEL KEEPS RUNNING UNTIL THE NEW ONE IS READY
+          m_model->reload_async([this](int return_code) {
+            // ATTRIBUTE IDS DEPEND ON THE LOADED MODEL
+            if (m_signal_attribute >= 0)
+              m_signal_attribute = m_model->get_float_attribute_id(
+                  std::string(signal_attribute));
+            if (m_info_outlet)
+              m_info_outlet->send("loaded", int(!return_code));
+          });
         } else if (attribute_name == "get_attributes") {
           for (std::string attr : settable_attributes) {
             cout << attr << endl;
@@ -107,6 +273,61 @@ public:
           for (std::string method : m_model->get_available_methods())
             cout << method << endl;
           return {};
+        } else if (attribute_name == "get_skipped") {
+          cout << "skipped buffers: "
+               << m_model->get_stats().get_deadline_misses() << endl;
+          return {};
+        } else if (attribute_name == "stats") {
+          // stats [reset]
+          if (args.size() > 1 && std::string(args[1]) == "reset") {
+            m_model->get_stats().reset();
+            return {};
+          }
+          for (const auto &line : m_model->get_stats().format())
+            cout << line << endl;
+          return {};
+        } else if (attribute_name == "get_device") {
+          // THE DEVICE CHOSEN BY THE AUTOMATIC PLACEMENT
+          cout << "device: " << m_model->get_device() << endl;
+          return {};
+        } else if (attribute_name == "get_precision") {
+          // THE REQUESTED PRECISION MAY NOT BE SUPPORTED BY THE MODEL
+          cout << "precision: " << m_model->get_precision() << endl;
+          return {};
+        } else if (attribute_name == "pool") {
+          // pool [threads [priority [core ...]]]
+          if (args.size() < 2) {
+            cout << "compute pool: " << ComputePool::get().get_num_threads()
+                 << " threads" << endl;
+            return {};
+          }
+          std::vector<int> affinity;
+          for (int i(3); i < args.size(); i++)
+            affinity.push_back(int(args[i]));
+          ComputePool::get().configure(
+              int(args[1]), args.size() > 2 ? int(args[2]) : 0, affinity);
+        } else if (attribute_name == "render") {
+          // render source destination [chunk_size [n_batches]]
+          if (args.size() < 3) {
+            cerr << "render needs a source and a destination buffer" << endl;
+            return {};
+          }
+          start_render(args[1], args[2], args.size() > 3 ? int(args[3]) : 65536,
+                       args.size() > 4 ? int(args[4]) : 1);
+          return {};
+        } else if (attribute_name == "cancel_render") {
+          m_renderer.cancel();
+          return {};
+        } else if (attribute_name == "torch_threads") {
+          // torch_threads [intra-op [inter-op]], FOR THE WHOLE PROCESS
+          if (args.size() < 2) {
+            auto budget = Backend::get_thread_budget();
+            cout << "torch threads: " << budget[0] << " intra-op, " << budget[1]
+                 << " inter-op" << endl;
+            return {};
+          }
+          Backend::set_thread_budget(int(args[1]),
+                                     args.size() > 2 ? int(args[2]) : 0);
         } else if (attribute_name == "get") {
           if (args.size() < 2) {
             cerr << "get must be given an attribute name" << endl;
@@ -135,7 +356,16 @@ public:
               attribute_args.push_back(args[i]);
             }
             try {
-              m_model->set_attribute(attribute_name, attribute_args);
+              // A SINGLE NUMBER TAKES THE TYPED PATH, WITHOUT ANY STRING
+              auto float_id = m_model->get_float_attribute_id(attribute_name);
+              if (float_id >= 0 && args.size() == 3 &&
+                  args[2].a_type != c74::max::A_SYM)
+                m_model->set_float_attribute(float_id, float(args[2]));
+              else
+                m_model->set_attribute(attribute_name, attribute_args);
+              // APPLIED BETWEEN TWO BUFFERS, EVEN WHEN THE DSP IS OFF
+              m_compute_strand.submit(
+                  [this] { m_model->apply_attribute_commands(); });
             } catch (std::string message) {
               cerr << message << endl;
             }
@@ -149,42 +379,17 @@ public:
       }};
 };
 
-void model_perform(nn *nn_instance) {
-  std::vector<float *> in_model, out_model;
-  for (int c(0); c < nn_instance->m_in_dim; c++)
-    in_model.push_back(nn_instance->m_in_model[c].get());
-  for (int c(0); c < nn_instance->m_out_dim; c++)
-    out_model.push_back(nn_instance->m_out_model[c].get());
-
-  nn_instance->m_model->perform(in_model, out_model, nn_instance->m_buffer_size,
-                                nn_instance->m_method, 1);
-}
-
-void model_perform_loop(nn *nn_instance) {
-  std::vector<float *> in_model, out_model;
-
-  for (auto &ptr : nn_instance->m_in_model)
-    in_model.push_back(ptr.get());
-
-  for (auto &ptr : nn_instance->m_out_model)
-    out_model.push_back(ptr.get());
-
-  while (!nn_instance->m_should_stop_perform_thread) {
-    if (nn_instance->m_data_available_lock.try_acquire_for(
-            std::chrono::milliseconds(200))) {
-      nn_instance->m_model->perform(in_model, out_model,
-                                    nn_instance->m_buffer_size,
-                                    nn_instance->m_method, 1);
-      nn_instance->m_result_available_lock.release();
-    }
-  }
+void model_perform(nn *nn_instance, buffer_pipeline::slot *slot) {
+  // THE BACKEND COPIES THE SLOT INTO THE MODEL INPUT TENSOR
+  nn_instance->m_model->perform_prepared(slot->input, slot->output,
+                                         nn_instance->m_buffer_size,
+                                         nn_instance->m_method_id, 1);
 }
 
 nn::nn(const atoms &args)
-    : m_compute_thread(nullptr), m_in_dim(1), m_in_ratio(1), m_out_dim(1),
-      m_out_ratio(1), m_buffer_size(4096), m_method("forward"),
-      m_use_thread(true), m_data_available_lock(0), m_result_available_lock(1),
-      m_should_stop_perform_thread(false) {
+    : m_in_dim(1), m_in_ratio(1), m_out_dim(1), m_out_ratio(1),
+      m_buffer_size(4096), m_method("forward"), m_method_id(-1),
+      m_use_thread(true) {
 
   m_model = std::make_unique<Backend>();
   m_is_backend_init = true;
@@ -206,6 +411,15 @@ nn::nn(const atoms &args)
     m_buffer_size = int(args[2]);
   }
 
+  m_model->set_optimization_level(optimize);
+  m_model->set_precision(std::string(precision));
+  if (std::string(device) != "")
+    m_model->set_device(std::string(device));
+  if (!profiling)
+    Backend::use_profiling_executor(false);
+  if (!cache)
+    Backend::use_model_cache(false);
+
   // TRY TO LOAD MODEL
   if (m_model->load(std::string(m_path))) {
     cerr << "error during loading" << endl;
@@ -213,11 +427,15 @@ nn::nn(const atoms &args)
     return;
   }
 
-  m_model->use_gpu(gpu);
+  if (std::string(device) == "")
+    m_model->use_gpu(gpu);
+  m_model->use_linear_interpolation(interpolate);
+  m_model->set_intra_op_threads(threads);
 
   m_higher_ratio = m_model->get_higher_ratio();
 
   // GET MODEL'S METHOD PARAMETERS
+  m_method_id = m_model->get_method_id(m_method);
   auto params = m_model->get_method_params(m_method);
 
   // GET MODEL'S SETTABLE ATTRIBUTES
@@ -246,56 +464,90 @@ nn::nn(const atoms &args)
     m_buffer_size = power_ceil(m_buffer_size);
   }
 
+  // THE MODEL RUNS ON BLOCKS SMALLER THAN A POWER OF TWO
+  if (block_size > 0)
+    m_buffer_size = ratio_ceil(block_size, m_higher_ratio);
+
   // Calling forward in a thread causes memory leak in windows.
   // See https://github.com/pytorch/pytorch/issues/24237
 #ifdef _WIN32
   m_use_thread = false;
 #endif
 
+  m_model->use_batching(batching && m_use_thread);
+
+  // ALLOCATE THE MODEL INPUT TENSOR ONCE, FILLED FROM THE SLOTS
+  m_model->prepare(m_method_id, m_buffer_size, 1);
+  m_model->set_warmup(warmup, m_buffer_size, 1);
+
   // CREATE INLETS, OUTLETS and BUFFERS
+  auto descriptor = m_model->get_method_descriptor(m_method_id);
   m_in_buffer = std::make_unique<circular_buffer<double, float>[]>(m_in_dim);
   for (int i(0); i < m_in_dim; i++) {
     std::string input_label = "";
     try {
-      input_label = m_model->get_model()
-                        .attr(m_method + "_input_labels")
-                        .toList()
-                        .get(i)
-                        .toStringRef();
+      input_label = descriptor->input_labels.at(i);
     } catch (...) {
       input_label = "(signal) model input " + std::to_string(i);
     }
     m_inlets.push_back(std::make_unique<inlet<>>(this, input_label, "signal"));
     m_in_buffer[i].initialize(m_buffer_size);
-    m_in_model.push_back(std::make_unique<float[]>(m_buffer_size));
+  }
+
+  // THE SIGNAL DRIVEN ATTRIBUTE TAKES THE TYPED, LOCK FREE PATH
+  std::string signal_attribute_name = signal_attribute;
+  if (signal_attribute_name.size()) {
+    m_signal_attribute = m_model->get_float_attribute_id(signal_attribute_name);
+    if (m_signal_attribute < 0)
+      cerr << "attribute " << signal_attribute_name
+           << " does not take a single float" << endl;
+    else
+      m_inlets.push_back(std::make_unique<inlet<>>(
+          this, "(signal) " + signal_attribute_name, "signal"));
   }
 
   m_out_buffer = std::make_unique<circular_buffer<float, double>[]>(m_out_dim);
   for (int i(0); i < m_out_dim; i++) {
     std::string output_label = "";
     try {
-      output_label = m_model->get_model()
-                         .attr(m_method + "_output_labels")
-                         .toList()
-                         .get(i)
-                         .toStringRef();
+      output_label = descriptor->output_labels.at(i);
     } catch (...) {
       output_label = "(signal) model output " + std::to_string(i);
     }
     m_outlets.push_back(
         std::make_unique<outlet<>>(this, output_label, "signal"));
-    m_out_buffer[i].initialize(m_buffer_size);
-    m_out_model.push_back(std::make_unique<float[]>(m_buffer_size));
+    m_out_buffer[i].initialize(2 * m_buffer_size);
   }
 
-  if (m_use_thread)
-    m_compute_thread = std::make_unique<std::thread>(model_perform_loop, this);
+  m_pipeline.initialize(m_use_thread ? max_pipeline_size : 1, m_in_dim,
+                        m_buffer_size / m_in_ratio, m_out_dim, m_buffer_size);
+  m_pipeline.resize(pipeline);
+
+  // NOTIFICATIONS, SENT FROM THE LOADING THREAD AND DEFERRED TO THE SCHEDULER
+  m_info_outlet = std::make_unique<
+      outlet<thread_check::scheduler, thread_action::fifo>>(
+      this, "(anything) notifications");
+  if (stats_interval > 0)
+    m_stats_timer.delay(stats_interval);
+}
+
+void nn::send_stats() {
+  if (!m_info_outlet || !m_model)
+    return;
+  auto &stats = m_model->get_stats();
+  for (const auto &stage : stats.get_stage_stats())
+    m_info_outlet->send("stats", stage.name, int(stage.count), stage.p50,
+                        stage.p95, stage.p99);
+  m_info_outlet->send("stats", "misses", stats.get_deadline_misses());
+  m_info_outlet->send("stats", "queue", stats.get_mean_queue_depth(),
+                      stats.get_max_queue_depth());
 }
 
 nn::~nn() {
-  m_should_stop_perform_thread = true;
-  if (m_compute_thread)
-    m_compute_thread->join();
+  // THE RELOAD CALLBACK USES MEMBERS DESTROYED BEFORE m_model
+  m_model->wait_for_load();
+  // WAIT FOR THE LAST COMPUTATION SUBMITTED TO THE POOL
+  m_compute_strand.wait();
 }
 
 bool nn::has_settable_attribute(std::string attribute) {
@@ -316,69 +568,164 @@ void fill_with_zero(audio_bundle output) {
 }
 
 void nn::operator()(audio_bundle input, audio_bundle output) {
-  auto dsp_vec_size = output.frame_count();
-
   // CHECK IF MODEL IS LOADED AND ENABLED
   if (!m_model->is_loaded() || !enable) {
     fill_with_zero(output);
     return;
   }
 
-  // CHECK IF DSP_VEC_SIZE IS LARGER THAN BUFFER SIZE
-  if (dsp_vec_size > m_buffer_size) {
-    cerr << "vector size (" << dsp_vec_size << ") ";
-    cerr << "larger than buffer size (" << m_buffer_size << "). ";
-    cerr << "disabling model.";
-    cerr << endl;
-    enable = false;
-    fill_with_zero(output);
-    return;
-  }
-
   perform(input, output);
 }
 
 void nn::perform(audio_bundle input, audio_bundle output) {
-  auto vec_size = input.frame_count();
+  int vec_size = input.frame_count();
+
+  // DELAY THE OUTPUT SO THAT IT NEVER UNDERRUNS WHEN THE BUFFER AND THE VECTOR
+  // SIZE ARE NOT MULTIPLES OF EACH OTHER
+  if (vec_size != m_dsp_vec_size) {
+    m_dsp_vec_size = vec_size;
+    for (int c(0); c < m_out_dim; c++) {
+      m_out_buffer[c].reset();
+      m_out_buffer[c].prime(m_buffer_size - std::gcd(vec_size, m_buffer_size));
+    }
+  }
 
-  // COPY INPUT TO CIRCULAR BUFFER
-  for (int c(0); c < input.channel_count(); c++) {
-    auto in = input.samples(c);
-    m_in_buffer[c].put(in, vec_size);
+  // PROCESS THE VECTOR IN CHUNKS ENDING ON BUFFER BOUNDARIES
+  for (int offset(0), n(0); offset < vec_size; offset += n) {
+    n = std::min(vec_size - offset,
+                 m_buffer_size - int(m_in_buffer[0].available()));
+
+    // COPY INPUT TO CIRCULAR BUFFER
+    for (int c(0); c < m_in_dim; c++)
+      m_in_buffer[c].put(input.samples(c) + offset, n);
+
+    if (m_in_buffer[0].full()) { // BUFFER IS FULL
+      // THE LAST SAMPLE OF THE BUFFER DRIVES THE ATTRIBUTE
+      auto attribute_id = m_signal_attribute.load(std::memory_order_relaxed);
+      if (attribute_id >= 0 && input.channel_count() > m_in_dim)
+        m_model->set_float_attribute(
+            attribute_id, float(input.samples(m_in_dim)[offset + n - 1]));
+      perform_buffer();
+    }
+
+    // COPY CIRCULAR BUFFER TO OUTPUT
+    for (int c(0); c < output.channel_count(); c++)
+      m_out_buffer[c].get(output.samples(c) + offset, n);
   }
+}
 
-  if (m_in_buffer[0].full()) { // BUFFER IS FULL
-    if (!m_use_thread) {
-      // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_in_dim; c++)
-        m_in_buffer[c].get(m_in_model[c].get(), m_buffer_size);
+void nn::perform_buffer() {
+  if (m_use_thread && m_pipeline.size() != pipeline)
+    m_pipeline.resize(pipeline);
 
-      // CALL MODEL PERFORM IN CURRENT THREAD
-      model_perform(this);
+  auto slot = m_pipeline.current();
 
-      // TRANSFER MEMORY BETWEEN OUTPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_out_dim; c++)
-        m_out_buffer[c].put(m_out_model[c].get(), m_buffer_size);
+  if (slot->busy.load(std::memory_order_acquire)) {
+    // DEADLINE MISSED, SKIP THE BUFFER RATHER THAN WAITING FOR THE MODEL
+    for (int c(0); c < m_in_dim; c++)
+      m_in_buffer[c].reset();
+    for (int c(0); c < m_out_dim; c++)
+      m_out_buffer[c].prime(m_buffer_size);
+    m_model->get_stats().record_deadline_miss();
+    return;
+  }
 
-    } else if (m_result_available_lock.try_acquire()) {
-      // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_in_dim; c++)
-        m_in_buffer[c].get(m_in_model[c].get(), m_buffer_size);
+  // TRANSFER THE RESULT COMPUTED `pipeline` BUFFERS AGO
+  for (int c(0); c < m_out_dim; c++) {
+    if (slot->has_result)
+      m_out_buffer[c].put(slot->output[c], m_buffer_size);
+    else if (m_use_thread)
+      m_out_buffer[c].prime(m_buffer_size);
+  }
 
-      // TRANSFER MEMORY BETWEEN OUTPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_out_dim; c++)
-        m_out_buffer[c].put(m_out_model[c].get(), m_buffer_size);
+  // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND SLOT, AT THE MODEL RATE
+  for (int c(0); c < m_in_dim; c++) {
+    if (average)
+      m_in_buffer[c].get_mean(slot->input[c], m_buffer_size, m_in_ratio);
+    else
+      m_in_buffer[c].get(slot->input[c], m_buffer_size, m_in_ratio);
+  }
 
-      // SIGNAL PERFORM THREAD THAT DATA IS AVAILABLE
-      m_data_available_lock.release();
+  if (!m_use_thread) {
+    // CALL MODEL PERFORM IN CURRENT THREAD
+    model_perform(this, slot);
+    for (int c(0); c < m_out_dim; c++)
+      m_out_buffer[c].put(slot->output[c], m_buffer_size);
+  } else {
+    // SUBMIT THE COMPUTATION TO THE SHARED POOL
+    m_model->get_stats().record_queue_depth(m_pipeline.in_flight());
+    slot->busy.store(true, std::memory_order_relaxed);
+    slot->has_result = true;
+    if (!m_compute_strand.submit([this, slot] {
+          model_perform(this, slot);
+          slot->busy.store(false, std::memory_order_release);
+        })) {
+      // THE STRAND IS FULL, THE BUFFER IS SKIPPED
+      slot->busy.store(false, std::memory_order_relaxed);
+      slot->has_result = false;
+      m_model->get_stats().record_deadline_miss();
     }
+    m_pipeline.advance();
   }
+}
 
-  // COPY CIRCULAR BUFFER TO OUTPUT
-  for (int c(0); c < output.channel_count(); c++) {
-    auto out = output.samples(c);
-    m_out_buffer[c].get(out, vec_size);
+void nn::start_render(symbol source, symbol destination, int chunk_size,
+                      int n_batches) {
+  if (!m_model->is_loaded())
+    return;
+  m_render_source.set(source);
+  m_render_destination.set(destination);
+
+  // THE WHOLE SOURCE IS COPIED, SO THAT THE BUFFER IS NOT LOCKED DURING THE
+  // (POSSIBLY LONG) RENDER
+  std::vector<std::vector<float>> inputs;
+  {
+    buffer_lock<false> b(m_render_source);
+    if (!b.valid()) {
+      cerr << "buffer " << source << " not found" << endl;
+      return;
+    }
+    for (int c(0); c < std::min(int(b.channel_count()), m_in_dim); c++) {
+      inputs.emplace_back(b.frame_count());
+      for (size_t i(0); i < b.frame_count(); i++)
+        inputs.back()[i] = b.lookup(i, c);
+    }
+  }
+
+  if (m_renderer.start(*m_model, m_method, std::move(inputs), chunk_size,
+                       n_batches, interpolate, average))
+    return;
+  m_render_timer.delay(100);
+}
+
+void nn::poll_render() {
+  if (m_renderer.is_running()) {
+    if (m_info_outlet)
+      m_info_outlet->send("render", "progress", m_renderer.get_progress());
+    m_render_timer.delay(100);
+    return;
+  }
+
+  std::vector<std::vector<float>> outputs;
+  auto failed = m_renderer.get_result(outputs);
+  if (!failed) {
+    buffer_lock<false> b(m_render_destination);
+    if (b.valid()) {
+      auto n_channels = std::min(b.channel_count(), outputs.size());
+      auto n_frames = std::min(b.frame_count(), outputs[0].size());
+      if (n_frames < outputs[0].size())
+        cerr << "destination buffer too short, render truncated" << endl;
+      for (size_t c(0); c < n_channels; c++)
+        for (size_t i(0); i < n_frames; i++)
+          b.lookup(i, c) = outputs[c][i];
+      b.dirty();
+    } else {
+      cerr << "destination buffer not found" << endl;
+      failed = 1;
+    }
   }
+  if (m_info_outlet)
+    m_info_outlet->send("render", "done", int(!failed));
 }
 
 MIN_EXTERNAL(nn);
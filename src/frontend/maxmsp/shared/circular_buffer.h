@@ -1,24 +1,40 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <memory>
 
+// Single producer / single consumer ring buffer. put() must only be called
+// from one thread and get() from another one (or the same). Head and tail
+// are free-running counters, wrapped with a power-of-two mask, and published
+// with release / acquire semantics so that the samples written before a put()
+// are visible to the thread calling get(). When the buffer is full, put()
+// overwrites the oldest samples by pushing the tail itself, so the reader
+// publishes its tail with a compare and swap, and a read overtaken by the
+// writer returns some of the newer samples.
 template <class in_type, class out_type> class circular_buffer {
 public:
   circular_buffer();
   void initialize(size_t size);
   bool empty();
   bool full();
+  size_t available();
   void put(in_type *input_array, int N);
+  void prime(int N);
   void get(out_type *output_array, int N);
+  void get(out_type *output_array, int N, int ratio);
+  void get_mean(out_type *output_array, int N, int ratio);
   void reset();
 
 protected:
   std::unique_ptr<out_type[]> _buffer;
-  size_t _max_size;
+  size_t _max_size = 0;
+  size_t _mask = 0;
 
-  int _head = 0;
-  int _tail = 0;
-  int _count = 0;
-  bool _full = false;
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+
+  void consume(size_t tail, size_t n);
 };
 
 template <class in_type, class out_type>
@@ -26,53 +42,172 @@ circular_buffer<in_type, out_type>::circular_buffer() {}
 
 template <class in_type, class out_type>
 void circular_buffer<in_type, out_type>::initialize(size_t size) {
-  _buffer = std::make_unique<out_type[]>(size);
+  size_t capacity = 1;
+  while (capacity < size)
+    capacity <<= 1;
+  _buffer = std::make_unique<out_type[]>(capacity);
   _max_size = size;
+  _mask = capacity - 1;
+  _head.store(0, std::memory_order_relaxed);
+  _tail.store(0, std::memory_order_relaxed);
 }
 
 template <class in_type, class out_type>
 bool circular_buffer<in_type, out_type>::empty() {
-  return (!_full && _head == _tail);
+  return _head.load(std::memory_order_acquire) ==
+         _tail.load(std::memory_order_acquire);
 }
 
 template <class in_type, class out_type>
 bool circular_buffer<in_type, out_type>::full() {
-  return _full;
+  return _head.load(std::memory_order_acquire) -
+             _tail.load(std::memory_order_acquire) >=
+         _max_size;
 }
 
+template <class in_type, class out_type>
+size_t circular_buffer<in_type, out_type>::available() {
+  return _head.load(std::memory_order_acquire) -
+         _tail.load(std::memory_order_acquire);
+}
+
+// WRITES N SAMPLES, OVERWRITING THE OLDEST ONES WHEN THE BUFFER IS FULL
 template <class in_type, class out_type>
 void circular_buffer<in_type, out_type>::put(in_type *input_array, int N) {
-  if (!_max_size)
+  if (!_max_size || N <= 0)
     return;
 
-  while (N--) {
-    _buffer[_head] = out_type(*(input_array++));
-    _head = (_head + 1) % _max_size;
-    if (_full)
-      _tail = (_tail + 1) % _max_size;
-    _full = _head == _tail;
-  }
+  // ONLY THE LAST _max_size SAMPLES CAN BE KEPT
+  size_t n = std::min(size_t(N), _max_size);
+  input_array += N - n;
+
+  // THE TAIL IS PUSHED PAST THE OVERWRITTEN SAMPLES BEFORE THEY ARE WRITTEN
+  auto head = _head.load(std::memory_order_relaxed);
+  auto tail = _tail.load(std::memory_order_acquire);
+  while (head + n - tail > _max_size &&
+         !_tail.compare_exchange_weak(tail, head + n - _max_size,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire))
+    ;
+
+  // TWO CONTIGUOUS SEGMENTS, CONVERTED ON THE FLY
+  auto start = head & _mask;
+  auto first = std::min(n, _mask + 1 - start);
+  std::copy_n(input_array, first, _buffer.get() + start);
+  std::copy_n(input_array + first, n - first, _buffer.get());
+
+  _head.store(head + n, std::memory_order_release);
+}
+
+// WRITES UP TO N ZEROS, USED TO DELAY THE READER BY A FIXED LATENCY. UNLIKE
+// put(), NOTHING IS OVERWRITTEN
+template <class in_type, class out_type>
+void circular_buffer<in_type, out_type>::prime(int N) {
+  if (!_max_size || N <= 0)
+    return;
+
+  auto head = _head.load(std::memory_order_relaxed);
+  auto tail = _tail.load(std::memory_order_acquire);
+  size_t n = std::min(size_t(N), _max_size - (head - tail));
+
+  auto start = head & _mask;
+  auto first = std::min(n, _mask + 1 - start);
+  std::fill_n(_buffer.get() + start, first, out_type());
+  std::fill_n(_buffer.get(), n - first, out_type());
+
+  _head.store(head + n, std::memory_order_release);
 }
 
+// READS N SAMPLES, MISSING ONES ARE FILLED WITH ZEROS
 template <class in_type, class out_type>
 void circular_buffer<in_type, out_type>::get(out_type *output_array, int N) {
-  if (!_max_size)
+  if (!_max_size || N <= 0)
+    return;
+
+  auto tail = _tail.load(std::memory_order_relaxed);
+  auto head = _head.load(std::memory_order_acquire);
+  size_t n = std::min(size_t(N), head - tail);
+
+  auto start = tail & _mask;
+  auto first = std::min(n, _mask + 1 - start);
+  std::copy_n(_buffer.get() + start, first, output_array);
+  std::copy_n(_buffer.get(), n - first, output_array + first);
+  std::fill_n(output_array + n, N - n, out_type());
+
+  consume(tail, n);
+}
+
+// CONSUMES N SAMPLES, ONLY KEEPING THE LAST ONE OF EVERY `ratio` SAMPLES
+template <class in_type, class out_type>
+void circular_buffer<in_type, out_type>::get(out_type *output_array, int N,
+                                             int ratio) {
+  if (!_max_size || N <= 0)
+    return;
+
+  auto tail = _tail.load(std::memory_order_relaxed);
+  auto head = _head.load(std::memory_order_acquire);
+  size_t n = std::min(size_t(N), head - tail);
+
+  for (size_t i(0), k(ratio - 1); k < size_t(N); i++, k += ratio)
+    output_array[i] = k < n ? _buffer[(tail + k) & _mask] : out_type();
+
+  consume(tail, n);
+}
+
+// CONSUMES N SAMPLES, KEEPING THE MEAN OF EVERY `ratio` SAMPLES (A BOX FILTER
+// ATTENUATING THE ALIASING OF THE DECIMATION). EACH WINDOW IS SUMMED OVER AT
+// MOST TWO CONTIGUOUS SEGMENTS, WITH FOUR INDEPENDENT ACCUMULATORS.
+template <class in_type, class out_type>
+void circular_buffer<in_type, out_type>::get_mean(out_type *output_array,
+                                                  int N, int ratio) {
+  if (!_max_size || N <= 0)
     return;
 
-  while (N--) {
-    if (empty()) {
-      *(output_array++) = out_type();
-    } else {
-      *(output_array++) = _buffer[_tail];
-      _tail = (_tail + 1) % _max_size;
-      _full = false;
+  auto tail = _tail.load(std::memory_order_relaxed);
+  auto head = _head.load(std::memory_order_acquire);
+  size_t n = std::min(size_t(N), head - tail);
+  const out_type inv_ratio = out_type(1) / out_type(ratio);
+
+  auto sum = [](const out_type *ptr, size_t size) {
+    out_type acc[4] = {};
+    size_t j(0);
+    for (; j + 4 <= size; j += 4) {
+      acc[0] += ptr[j];
+      acc[1] += ptr[j + 1];
+      acc[2] += ptr[j + 2];
+      acc[3] += ptr[j + 3];
     }
+    for (; j < size; j++)
+      acc[0] += ptr[j];
+    return acc[0] + acc[1] + acc[2] + acc[3];
+  };
+
+  for (size_t i(0), k(0); k + ratio <= size_t(N); i++, k += ratio) {
+    // MISSING SAMPLES COUNT AS ZEROS
+    auto available = k < n ? std::min(size_t(ratio), n - k) : 0;
+    auto start = (tail + k) & _mask;
+    auto first = std::min(available, _mask + 1 - start);
+    output_array[i] = (sum(_buffer.get() + start, first) +
+                       sum(_buffer.get(), available - first)) *
+                      inv_ratio;
   }
+
+  consume(tail, n);
+}
+
+// THE TAIL ONLY MOVES FORWARD, put() MAY HAVE PUSHED IT FURTHER WHILE THE
+// SAMPLES WERE READ
+template <class in_type, class out_type>
+void circular_buffer<in_type, out_type>::consume(size_t tail, size_t n) {
+  auto target = tail + n;
+  while (tail < target &&
+         !_tail.compare_exchange_weak(tail, target, std::memory_order_release,
+                                      std::memory_order_relaxed))
+    ;
 }
 
 template <class in_type, class out_type>
 void circular_buffer<in_type, out_type>::reset() {
-  _head = _tail;
-  _count = 0;
-  _full = false;
-}
\ No newline at end of file
+  _tail.store(_head.load(std::memory_order_acquire),
+              std::memory_order_release);
+}
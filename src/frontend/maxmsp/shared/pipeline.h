@@ -0,0 +1,108 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// NUMBER OF SLOTS PREALLOCATED BY THE MAX EXTERNALS, SO THAT THE PIPELINE
+// CAN BE RESIZED FROM THE AUDIO THREAD
+constexpr int max_pipeline_size = 8;
+
+// Fixed ring of buffers in flight between the audio thread and the compute
+// pool. The audio thread fills the input of the current slot, hands it over
+// to the compute side and moves on to the next slot. It collects the output
+// of a slot when coming back to it, `size()` buffers later. A slot that is
+// still busy at that point has missed its deadline.
+class buffer_pipeline {
+public:
+  struct slot {
+    std::vector<float *> input, output;
+    std::atomic<bool> busy{false};
+    bool has_result = false;
+    // VOICES (BATCHES) TO COMPUTE, THE OTHER ONES ARE SILENCED. THE INPUTS
+    // AND OUTPUTS OF THE VOICES UP TO THE LAST ACTIVE ONE ARE GATHERED IN
+    // active_input AND active_output BY THE COMPUTE SIDE.
+    std::vector<int> active;
+    std::vector<float *> active_input, active_output;
+  };
+
+  void initialize(int capacity, int in_channels, int in_size,
+                  int out_channels, int out_size);
+  void resize(int n_slots);
+  // NUMBER OF CHANNELS OF A SLOT IN USE, UP TO THE ONES GIVEN TO initialize.
+  // CHANNELS KEEP THEIR MEMORY, NOTHING IS ALLOCATED.
+  void set_channels(slot *target, int in_channels, int out_channels);
+  int size() { return _n_slots; }
+  int capacity() { return _capacity; }
+  slot *current() { return &_slots[_current]; }
+  void advance() { _current = (_current + 1) % _n_slots; }
+  int in_flight(); // number of slots still being computed
+
+protected:
+  std::unique_ptr<slot[]> _slots;
+  std::unique_ptr<float[]> _memory;
+  int _capacity = 0;
+  int _n_slots = 0;
+  int _current = 0;
+  int _in_channels = 0, _in_size = 0, _out_channels = 0, _out_size = 0;
+};
+
+inline void buffer_pipeline::initialize(int capacity, int in_channels,
+                                        int in_size, int out_channels,
+                                        int out_size) {
+  _capacity = std::max(capacity, 1);
+  _n_slots = _capacity;
+  _current = 0;
+  _slots = std::make_unique<slot[]>(_capacity);
+  _in_channels = in_channels;
+  _in_size = in_size;
+  _out_channels = out_channels;
+  _out_size = out_size;
+
+  // A SINGLE ALLOCATION, SPLIT BETWEEN SLOTS AND CHANNELS
+  size_t slot_size = in_channels * in_size + out_channels * out_size;
+  _memory = std::make_unique<float[]>(_capacity * slot_size);
+
+  for (int s(0); s < _capacity; s++) {
+    auto ptr = _memory.get() + s * slot_size;
+    for (int c(0); c < in_channels; c++, ptr += in_size)
+      _slots[s].input.push_back(ptr);
+    for (int c(0); c < out_channels; c++, ptr += out_size)
+      _slots[s].output.push_back(ptr);
+    // THERE ARE NEVER MORE VOICES THAN CHANNELS
+    _slots[s].active.reserve(in_channels);
+    _slots[s].active_input.reserve(in_channels);
+    _slots[s].active_output.reserve(out_channels);
+  }
+}
+
+// CHANGES THE NUMBER OF SLOTS IN USE WITHOUT ALLOCATING, FROM THE AUDIO
+// THREAD. PENDING RESULTS ARE DISCARDED, SLOTS STILL BUSY STAY GUARDED.
+inline void buffer_pipeline::resize(int n_slots) {
+  _n_slots = std::clamp(n_slots, 1, _capacity);
+  _current = 0;
+  for (int s(0); s < _capacity; s++)
+    _slots[s].has_result = false;
+}
+
+inline void buffer_pipeline::set_channels(slot *target, int in_channels,
+                                          int out_channels) {
+  auto ptr = _memory.get() + (target - _slots.get()) *
+                                 (_in_channels * _in_size +
+                                  _out_channels * _out_size);
+  // THE VECTORS WERE FILLED UP TO THEIR MAXIMUM SIZE BY initialize
+  target->input.resize(std::clamp(in_channels, 0, _in_channels));
+  target->output.resize(std::clamp(out_channels, 0, _out_channels));
+  for (int c(0); c < target->input.size(); c++)
+    target->input[c] = ptr + c * _in_size;
+  ptr += _in_channels * _in_size;
+  for (int c(0); c < target->output.size(); c++)
+    target->output[c] = ptr + c * _out_size;
+}
+
+inline int buffer_pipeline::in_flight() {
+  int n_busy = 0;
+  for (int s(0); s < _n_slots; s++)
+    n_busy += _slots[s].busy.load(std::memory_order_relaxed);
+  return n_busy;
+}
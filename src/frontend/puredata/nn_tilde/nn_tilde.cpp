@@ -1,8 +1,14 @@
 #include "../../../backend/backend.h"
+#include "../../../backend/offline_render.h"
+#include "../../../backend/thread_pool.h"
 #include "../../maxmsp/shared/circular_buffer.h"
+#include "../../maxmsp/shared/pipeline.h"
 #include "m_pd.h"
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <numeric>
 #include <string>
 #include <vector>
 
@@ -22,6 +28,18 @@ unsigned power_ceil(unsigned x) {
   return power;
 }
 
+unsigned ratio_ceil(unsigned x, unsigned ratio) {
+  return std::max(1u, (x + ratio - 1) / ratio) * ratio;
+}
+
+// BUFFERS FOR ONE BUFFER SIZE AND PIPELINE DEPTH, BUILT ON THE STRAND AND
+// SWAPPED IN BY THE DSP TICK
+struct nn_tilde_buffers {
+  int generation, buffer_size;
+  std::unique_ptr<circular_buffer<float, float>[]> in_buffer, out_buffer;
+  std::unique_ptr<buffer_pipeline> pipeline;
+};
+
 // CLASS LIKE INITIALISATION
 typedef struct _nn_tilde {
   t_object x_obj;
@@ -32,14 +50,39 @@ typedef struct _nn_tilde {
   std::unique_ptr<Backend> m_model;
   std::vector<std::string> settable_attributes;
   t_symbol *m_method, *m_path;
-  std::unique_ptr<std::thread> m_compute_thread;
+  int m_method_id, m_warmup;
+  std::unique_ptr<Strand> m_compute_strand;
+
+  // BACKGROUND LOADING, -1 WHILE PENDING, THEN THE LOADING RETURN CODE
+  std::unique_ptr<std::atomic<int>> m_load_status;
+  t_clock *m_load_clock;
+  t_outlet *m_info_outlet;
 
   // BUFFER RELATED MEMBERS
   int m_head, m_in_dim, m_in_ratio, m_out_dim, m_out_ratio, m_buffer_size;
 
   std::unique_ptr<circular_buffer<float, float>[]> m_in_buffer;
   std::unique_ptr<circular_buffer<float, float>[]> m_out_buffer;
-  std::vector<std::unique_ptr<float[]>> m_in_model, m_out_model;
+
+  // BUFFERS IN FLIGHT BETWEEN THE AUDIO THREAD AND THE COMPUTE POOL
+  std::unique_ptr<buffer_pipeline> m_pipeline;
+  int m_pipeline_size, m_missed_deadlines;
+  t_clock *m_report_clock;
+
+  // BUFFERS WAITING FOR THE NEXT DSP TICK. THE MODEL IS NOT CALLED UNTIL THE
+  // BUFFERS OF THE LAST RESET ARE IN USE
+  std::unique_ptr<std::atomic<nn_tilde_buffers *>> m_next_buffers;
+  int m_reset_generation, m_live_generation, m_next_buffer_size;
+
+  // OFFLINE RENDERING BETWEEN ARRAYS, POLLED FROM THE SCHEDULER
+  std::unique_ptr<OfflineRenderer> m_renderer;
+  t_symbol *m_render_destination;
+  t_clock *m_render_clock;
+  int m_interpolate, m_average;
+
+  // PERIODIC STATS, SENT THROUGH THE CONTROL OUTLET
+  int m_stats_interval;
+  t_clock *m_stats_clock;
 
   bool m_use_thread;
 
@@ -50,22 +93,169 @@ typedef struct _nn_tilde {
 
 } t_nn_tilde;
 
-void model_perform(t_nn_tilde *nn_instance) {
-  std::vector<float *> in_model, out_model;
+void model_perform(t_nn_tilde *nn_instance, buffer_pipeline::slot *slot) {
+  // THE BACKEND COPIES THE SLOT INTO THE MODEL INPUT TENSOR
+  nn_instance->m_model->perform_prepared(slot->input, slot->output,
+                                         nn_instance->m_buffer_size,
+                                         nn_instance->m_method_id, 1);
+}
+
+// DELAYS THE OUTPUT SO THAT IT NEVER UNDERRUNS WHEN THE BUFFER SIZE AND THE
+// VECTOR SIZE ARE NOT MULTIPLES OF EACH OTHER
+void nn_tilde_prime_output(t_nn_tilde *x) {
+  if (!x->m_dsp_vec_size)
+    return;
+  auto latency =
+      x->m_buffer_size - std::gcd(x->m_dsp_vec_size, x->m_buffer_size);
+  for (int c(0); c < x->m_out_dim; c++) {
+    x->m_out_buffer[c].reset();
+    x->m_out_buffer[c].prime(latency);
+  }
+}
+
+// ALLOCATES THE BUFFERS FOR A BUFFER SIZE AND PIPELINE DEPTH, AND WARMS THE
+// MODEL UP FOR THEM. RUNS ON THE STRAND, AFTER THE BUFFERS IN FLIGHT
+nn_tilde_buffers *nn_tilde_build_buffers(t_nn_tilde *x, int generation,
+                                         int buffer_size, int pipeline_size,
+                                         int warmup) {
+  // ALLOCATE THE MODEL INPUT TENSOR ONCE, FILLED FROM THE SLOTS
+  x->m_model->prepare(x->m_method_id, buffer_size, 1);
+  x->m_model->set_warmup(warmup, buffer_size, 1);
+
+  auto buffers = new nn_tilde_buffers;
+  buffers->generation = generation;
+  buffers->buffer_size = buffer_size;
+  buffers->in_buffer =
+      std::make_unique<circular_buffer<float, float>[]>(x->m_in_dim);
+  for (int i(0); i < x->m_in_dim; i++)
+    buffers->in_buffer[i].initialize(buffer_size);
+  buffers->out_buffer =
+      std::make_unique<circular_buffer<float, float>[]>(x->m_out_dim);
+  for (int i(0); i < x->m_out_dim; i++)
+    buffers->out_buffer[i].initialize(2 * buffer_size);
+  buffers->pipeline = std::make_unique<buffer_pipeline>();
+  buffers->pipeline->initialize(pipeline_size, x->m_in_dim,
+                                buffer_size / x->m_in_ratio, x->m_out_dim,
+                                buffer_size);
+  return buffers;
+}
+
+// CALLED BY THE DSP TICK, PUTS THE BUFFERS OF THE LAST RESET IN USE
+void nn_tilde_swap_buffers(t_nn_tilde *x) {
+  auto buffers = x->m_next_buffers->exchange(nullptr);
+  if (!buffers)
+    return;
+  x->m_live_generation = buffers->generation;
+  x->m_buffer_size = buffers->buffer_size;
+  std::swap(x->m_in_buffer, buffers->in_buffer);
+  std::swap(x->m_out_buffer, buffers->out_buffer);
+  std::swap(x->m_pipeline, buffers->pipeline);
+  nn_tilde_prime_output(x);
+
+  // NO BUFFER IS SUBMITTED WHILE A RESET IS PENDING, SO THE PREVIOUS BUFFERS
+  // ARE IDLE. THEY ARE RELEASED ON THE STRAND RATHER THAN IN THE DSP TICK
+  if (!x->m_compute_strand->submit([buffers] { delete buffers; }))
+    delete buffers;
+}
+
+// REBUILDS THE BUFFERS FOR A NEW BUFFER SIZE OR PIPELINE DEPTH WITHOUT
+// BLOCKING THE SCHEDULER, THEY ARE SWAPPED IN AT THE NEXT DSP TICK
+void nn_tilde_reset_buffers(t_nn_tilde *x, int buffer_size) {
+  auto generation = ++x->m_reset_generation;
+  auto pipeline_size = x->m_use_thread ? x->m_pipeline_size : 1;
+  auto warmup = x->m_warmup;
+  auto next = x->m_next_buffers.get();
+  if (!x->m_compute_strand->submit([=] {
+        auto buffers = nn_tilde_build_buffers(x, generation, buffer_size,
+                                              pipeline_size, warmup);
+        // BUFFERS OF A PREVIOUS RESET THAT WERE NEVER SWAPPED IN ARE DROPPED
+        delete next->exchange(buffers);
+      })) {
+    x->m_reset_generation--;
+    post("nn~: compute queue full, buffers not reset");
+    return;
+  }
+  x->m_next_buffer_size = buffer_size;
+}
+
+void nn_tilde_report(t_nn_tilde *x) {
+  std::string message = "nn~: ";
+  message += std::to_string(x->m_missed_deadlines);
+  message += " buffer(s) dropped, the model missed its deadline (consider "
+             "increasing the pipeline size)";
+  post(message.c_str());
+  x->m_missed_deadlines = 0;
+}
+
+void nn_tilde_perform_buffer(t_nn_tilde *x) {
+  if (x->m_live_generation != x->m_reset_generation) {
+    // THE BUFFERS ARE BEING REBUILT, THE MODEL IS LEFT TO THE STRAND
+    for (int c(0); c < x->m_in_dim; c++)
+      x->m_in_buffer[c].reset();
+    for (int c(0); c < x->m_out_dim; c++)
+      x->m_out_buffer[c].prime(x->m_buffer_size);
+    return;
+  }
+
+  auto slot = x->m_pipeline->current();
+
+  if (slot->busy.load(std::memory_order_acquire)) {
+    // DEADLINE MISSED, DROP THE BUFFER RATHER THAN WAITING FOR THE MODEL
+    for (int c(0); c < x->m_in_dim; c++)
+      x->m_in_buffer[c].reset();
+    for (int c(0); c < x->m_out_dim; c++)
+      x->m_out_buffer[c].prime(x->m_buffer_size);
+    x->m_model->get_stats().record_deadline_miss();
+    if (!x->m_missed_deadlines++)
+      clock_delay(x->m_report_clock, 1000);
+    return;
+  }
+
+  // TRANSFER THE RESULT COMPUTED `pipeline` BUFFERS AGO
+  for (int c(0); c < x->m_out_dim; c++) {
+    if (slot->has_result)
+      x->m_out_buffer[c].put(slot->output[c], x->m_buffer_size);
+    else if (x->m_use_thread)
+      x->m_out_buffer[c].prime(x->m_buffer_size);
+  }
 
-  for (int c(0); c < nn_instance->m_in_dim; c++)
-    in_model.push_back(nn_instance->m_in_model[c].get());
-  for (int c(0); c < nn_instance->m_out_dim; c++)
-    out_model.push_back(nn_instance->m_out_model[c].get());
+  // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND SLOT, AT THE MODEL RATE
+  for (int c(0); c < x->m_in_dim; c++) {
+    if (x->m_average)
+      x->m_in_buffer[c].get_mean(slot->input[c], x->m_buffer_size,
+                                 x->m_in_ratio);
+    else
+      x->m_in_buffer[c].get(slot->input[c], x->m_buffer_size, x->m_in_ratio);
+  }
 
-  nn_instance->m_model->perform(in_model, out_model, nn_instance->m_buffer_size,
-                                nn_instance->m_method->s_name, 1);
+  if (!x->m_use_thread) { // PROCESS DATA RIGHT NOW
+    model_perform(x, slot);
+    for (int c(0); c < x->m_out_dim; c++)
+      x->m_out_buffer[c].put(slot->output[c], x->m_buffer_size);
+  } else { // PROCESS DATA LATER, ON THE SHARED POOL
+    x->m_model->get_stats().record_queue_depth(x->m_pipeline->in_flight());
+    slot->busy.store(true, std::memory_order_relaxed);
+    slot->has_result = true;
+    if (!x->m_compute_strand->submit([x, slot] {
+          model_perform(x, slot);
+          slot->busy.store(false, std::memory_order_release);
+        })) {
+      // THE STRAND IS FULL, THE BUFFER IS SKIPPED
+      slot->busy.store(false, std::memory_order_relaxed);
+      slot->has_result = false;
+      x->m_model->get_stats().record_deadline_miss();
+    }
+    x->m_pipeline->advance();
+  }
 }
 
 // DSP CALL
 t_int *nn_tilde_perform(t_int *w) {
   t_nn_tilde *x = (t_nn_tilde *)(w[1]);
 
+  if (x->m_model->is_loaded())
+    nn_tilde_swap_buffers(x);
+
   if (!x->m_model->is_loaded() || !x->m_enabled) {
     for (int c(0); c < x->m_out_dim; c++) {
       for (int i(0); i < x->m_dsp_vec_size; i++) {
@@ -75,35 +265,21 @@ t_int *nn_tilde_perform(t_int *w) {
     return w + 2;
   }
 
-  // COPY INPUT TO CIRCULAR BUFFER
-  for (int c(0); c < x->m_in_dim; c++) {
-    x->m_in_buffer[c].put(x->m_dsp_in_vec[c], x->m_dsp_vec_size);
-  }
-
-  if (x->m_in_buffer[0].full()) { // BUFFER IS FULL
-    // IF USE THREAD, CHECK THAT COMPUTATION IS OVER
-    if (x->m_compute_thread && x->m_use_thread) {
-      x->m_compute_thread->join();
-    }
+  // PROCESS THE VECTOR IN CHUNKS ENDING ON BUFFER BOUNDARIES
+  for (int offset(0), n(0); offset < x->m_dsp_vec_size; offset += n) {
+    n = std::min(x->m_dsp_vec_size - offset,
+                 x->m_buffer_size - int(x->m_in_buffer[0].available()));
 
-    // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND MODEL BUFFER
+    // COPY INPUT TO CIRCULAR BUFFER
     for (int c(0); c < x->m_in_dim; c++)
-      x->m_in_buffer[c].get(x->m_in_model[c].get(), x->m_buffer_size);
+      x->m_in_buffer[c].put(x->m_dsp_in_vec[c] + offset, n);
 
-    if (!x->m_use_thread) // PROCESS DATA RIGHT NOW
-      model_perform(x);
+    if (x->m_in_buffer[0].full()) // BUFFER IS FULL
+      nn_tilde_perform_buffer(x);
 
-    // TRANSFER MEMORY BETWEEN OUTPUT CIRCULAR BUFFER AND MODEL BUFFER
+    // COPY CIRCULAR BUFFER TO OUTPUT
     for (int c(0); c < x->m_out_dim; c++)
-      x->m_out_buffer[c].put(x->m_out_model[c].get(), x->m_buffer_size);
-
-    if (x->m_use_thread) // PROCESS DATA LATER
-      x->m_compute_thread = std::make_unique<std::thread>(model_perform, x);
-  }
-
-  // COPY CIRCULAR BUFFER TO OUTPUT
-  for (int c(0); c < x->m_out_dim; c++) {
-    x->m_out_buffer[c].get(x->m_dsp_out_vec[c], x->m_dsp_vec_size);
+      x->m_out_buffer[c].get(x->m_dsp_out_vec[c] + offset, n);
   }
 
   return w + 2;
@@ -120,13 +296,106 @@ void nn_tilde_dsp(t_nn_tilde *x, t_signal **sp) {
   for (int i(x->m_in_dim); i < x->m_in_dim + x->m_out_dim; i++) {
     x->m_dsp_out_vec.push_back(sp[i]->s_vec);
   }
+  if (x->m_model->is_loaded())
+    nn_tilde_prime_output(x);
   dsp_add(nn_tilde_perform, 1, x);
 }
 
+// POLLED FROM THE SCHEDULER, AS OUTLETS CANNOT BE USED FROM THE LOADING THREAD
+void nn_tilde_poll_load(t_nn_tilde *x) {
+  int status = x->m_load_status->load();
+  if (status < 0) {
+    clock_delay(x->m_load_clock, 50);
+    return;
+  }
+  if (x->m_info_outlet) {
+    t_atom success;
+    SETFLOAT(&success, !status);
+    outlet_anything(x->m_info_outlet, gensym("loaded"), 1, &success);
+  }
+}
+
+void nn_tilde_send_stats(t_nn_tilde *x) {
+  if (x->m_info_outlet) {
+    auto &stats = x->m_model->get_stats();
+    t_atom atoms[5];
+    for (const auto &stage : stats.get_stage_stats()) {
+      SETSYMBOL(atoms, gensym(stage.name.c_str()));
+      SETFLOAT(atoms + 1, stage.count);
+      SETFLOAT(atoms + 2, stage.p50);
+      SETFLOAT(atoms + 3, stage.p95);
+      SETFLOAT(atoms + 4, stage.p99);
+      outlet_anything(x->m_info_outlet, gensym("stats"), 5, atoms);
+    }
+    SETSYMBOL(atoms, gensym("misses"));
+    SETFLOAT(atoms + 1, stats.get_deadline_misses());
+    outlet_anything(x->m_info_outlet, gensym("stats"), 2, atoms);
+    SETSYMBOL(atoms, gensym("queue"));
+    SETFLOAT(atoms + 1, stats.get_mean_queue_depth());
+    SETFLOAT(atoms + 2, stats.get_max_queue_depth());
+    outlet_anything(x->m_info_outlet, gensym("stats"), 3, atoms);
+  }
+  if (x->m_stats_interval > 0)
+    clock_delay(x->m_stats_clock, x->m_stats_interval);
+}
+
+void nn_tilde_poll_render(t_nn_tilde *x) {
+  t_atom atoms[2];
+  SETSYMBOL(atoms, gensym("progress"));
+  if (x->m_renderer->is_running()) {
+    SETFLOAT(atoms + 1, x->m_renderer->get_progress());
+    outlet_anything(x->m_info_outlet, gensym("render"), 2, atoms);
+    clock_delay(x->m_render_clock, 100);
+    return;
+  }
+
+  std::vector<std::vector<float>> outputs;
+  auto failed = x->m_renderer->get_result(outputs);
+  if (!failed) {
+    auto array = (t_garray *)pd_findbyclass(x->m_render_destination,
+                                            garray_class);
+    int n_frames;
+    t_word *vec;
+    if (array) {
+      // THE DESTINATION IS RESIZED TO THE LENGTH OF THE RENDER
+      garray_resize_long(array, outputs[0].size());
+      garray_getfloatwords(array, &n_frames, &vec);
+      for (int i(0); i < n_frames; i++)
+        vec[i].w_float = outputs[0][i];
+      garray_redraw(array);
+    } else {
+      post("nn~: destination array not found");
+      failed = 1;
+    }
+  }
+  SETSYMBOL(atoms, gensym("done"));
+  SETFLOAT(atoms + 1, !failed);
+  outlet_anything(x->m_info_outlet, gensym("render"), 2, atoms);
+}
+
 void nn_tilde_free(t_nn_tilde *x) {
-  if (x->m_compute_thread) {
-    x->m_compute_thread->join();
+  if (x->m_compute_strand) {
+    x->m_compute_strand->wait();
+  }
+  if (x->m_next_buffers) {
+    delete x->m_next_buffers->exchange(nullptr);
+  }
+  if (x->m_report_clock) {
+    clock_free(x->m_report_clock);
+  }
+  if (x->m_load_clock) {
+    clock_free(x->m_load_clock);
   }
+  if (x->m_stats_clock) {
+    clock_free(x->m_stats_clock);
+  }
+  if (x->m_render_clock) {
+    clock_free(x->m_render_clock);
+  }
+  // CANCELS AND JOINS A RUNNING RENDER
+  x->m_renderer.reset();
+  // JOINS A PENDING LOAD BEFORE THE OBJECT GOES AWAY
+  x->m_model.reset();
 }
 
 void *nn_tilde_new(t_symbol *s, int argc, t_atom *argv) {
@@ -134,13 +403,30 @@ void *nn_tilde_new(t_symbol *s, int argc, t_atom *argv) {
 
   x->m_model = std::make_unique<Backend>();
   x->m_head = 0;
-  x->m_compute_thread = nullptr;
+  x->m_compute_strand = std::make_unique<Strand>();
+  x->m_pipeline = std::make_unique<buffer_pipeline>();
+  x->m_pipeline_size = 1;
+  x->m_next_buffers = std::make_unique<std::atomic<nn_tilde_buffers *>>();
+  x->m_reset_generation = 0;
+  x->m_live_generation = 0;
+  x->m_missed_deadlines = 0;
+  x->m_report_clock = clock_new(x, (t_method)nn_tilde_report);
+  x->m_load_status = std::make_unique<std::atomic<int>>(-1);
+  x->m_load_clock = clock_new(x, (t_method)nn_tilde_poll_load);
+  x->m_stats_interval = 0;
+  x->m_stats_clock = clock_new(x, (t_method)nn_tilde_send_stats);
+  x->m_renderer = std::make_unique<OfflineRenderer>();
+  x->m_render_clock = clock_new(x, (t_method)nn_tilde_poll_render);
+  x->m_interpolate = 0;
+  x->m_average = 0;
   x->m_in_dim = 1;
   x->m_in_ratio = 1;
   x->m_out_dim = 1;
   x->m_out_ratio = 1;
   x->m_buffer_size = 4096;
   x->m_method = gensym("forward");
+  x->m_method_id = -1;
+  x->m_warmup = 2;
   x->m_enabled = 1;
   x->m_use_thread = true;
 
@@ -187,6 +473,7 @@ void *nn_tilde_new(t_symbol *s, int argc, t_atom *argv) {
     x->m_method = gensym("forward");
     params = x->m_model->get_method_params(x->m_method->s_name);
   }
+  x->m_method_id = x->m_model->get_method_id(x->m_method->s_name);
 
   x->m_in_dim = params[0];
   x->m_in_ratio = params[1];
@@ -209,28 +496,186 @@ void *nn_tilde_new(t_symbol *s, int argc, t_atom *argv) {
   }
 
   // CREATE INLETS, OUTLETS and BUFFERS
-  x->m_in_buffer =
-      std::make_unique<circular_buffer<float, float>[]>(x->m_in_dim);
   for (int i(0); i < x->m_in_dim; i++) {
     if (i < x->m_in_dim - 1)
       inlet_new(&x->x_obj, &x->x_obj.ob_pd, &s_signal, &s_signal);
-    x->m_in_buffer[i].initialize(x->m_buffer_size);
-    x->m_in_model.push_back(std::make_unique<float[]>(x->m_buffer_size));
   }
-
-  x->m_out_buffer =
-      std::make_unique<circular_buffer<float, float>[]>(x->m_out_dim);
   for (int i(0); i < x->m_out_dim; i++) {
     outlet_new(&x->x_obj, &s_signal);
-    x->m_out_buffer[i].initialize(x->m_buffer_size);
-    x->m_out_model.push_back(std::make_unique<float[]>(x->m_buffer_size));
   }
+  x->m_info_outlet = outlet_new(&x->x_obj, &s_anything);
+
+  // NOTHING RUNS YET, THE FIRST BUFFERS ARE BUILT AND PUT IN USE RIGHT AWAY
+  x->m_next_buffer_size = x->m_buffer_size;
+  x->m_next_buffers->store(nn_tilde_build_buffers(
+      x, 0, x->m_buffer_size, x->m_use_thread ? x->m_pipeline_size : 1,
+      x->m_warmup));
+  nn_tilde_swap_buffers(x);
 
   return (void *)x;
 }
 
 void nn_tilde_enable(t_nn_tilde *x, t_floatarg arg) { x->m_enabled = int(arg); }
-void nn_tilde_reload(t_nn_tilde *x) { x->m_model->reload(); }
+void nn_tilde_reload(t_nn_tilde *x) {
+  // THE CURRENT MODEL KEEPS RUNNING UNTIL THE NEW ONE IS READY
+  x->m_load_status->store(-1);
+  auto status = x->m_load_status.get();
+  if (!x->m_model->reload_async([status](int code) { status->store(code); }))
+    clock_delay(x->m_load_clock, 50);
+}
+void nn_tilde_interpolate(t_nn_tilde *x, t_floatarg arg) {
+  x->m_interpolate = int(arg);
+  x->m_model->use_linear_interpolation(int(arg));
+}
+void nn_tilde_average(t_nn_tilde *x, t_floatarg arg) {
+  // BOX FILTER DECIMATION OF THE INPUTS, INSTEAD OF ONE SAMPLE PER RATIO
+  x->m_average = int(arg);
+}
+void nn_tilde_batching(t_nn_tilde *x, t_floatarg arg) {
+  x->m_model->use_batching(int(arg) && x->m_use_thread);
+}
+void nn_tilde_pipeline(t_nn_tilde *x, t_floatarg arg) {
+  // NUMBER OF BUFFERS IN FLIGHT, EACH ONE ADDS A BUFFER OF LATENCY
+  x->m_pipeline_size = std::max(int(arg), 1);
+  if (x->m_model->is_loaded())
+    nn_tilde_reset_buffers(x, x->m_next_buffer_size);
+}
+void nn_tilde_block_size(t_nn_tilde *x, t_floatarg arg) {
+  // OVERRIDES THE BUFFER SIZE, ROUNDED TO THE MODEL RATIO (NOT TO A POWER OF
+  // TWO)
+  if (!x->m_model->is_loaded() || int(arg) <= 0)
+    return;
+  nn_tilde_reset_buffers(
+      x, ratio_ceil(int(arg), x->m_model->get_higher_ratio()));
+}
+void nn_tilde_warmup(t_nn_tilde *x, t_floatarg arg) {
+  // CALLS RUN ON SILENCE AFTER EVERY LOAD, BEFORE THE MODEL IS SWAPPED IN
+  x->m_warmup = std::max(int(arg), 0);
+  if (!x->m_model->is_loaded())
+    return;
+  auto warmup = x->m_warmup;
+  auto buffer_size = x->m_next_buffer_size;
+  if (!x->m_compute_strand->submit([x, warmup, buffer_size] {
+        x->m_model->set_warmup(warmup, buffer_size, 1);
+      }))
+    post("nn~: compute queue full, warm-up not applied");
+}
+void nn_tilde_optimize(t_nn_tilde *x, t_floatarg arg) {
+  // 0: NONE, 1: FREEZE, 2: FREEZE + INFERENCE PASSES, APPLIED BY RELOADING
+  x->m_model->set_optimization_level(int(arg));
+  if (x->m_model->is_loaded())
+    nn_tilde_reload(x);
+}
+// precision [fp32 | fp16 | bf16], APPLIED BY RELOADING. WITHOUT
+// ARGUMENT, PRINTS THE PRECISION IN USE
+void nn_tilde_precision(t_nn_tilde *x, t_symbol *arg) {
+  if (arg == &s_) {
+    std::string message = "precision: " + x->m_model->get_precision();
+    post(message.c_str());
+    return;
+  }
+  if (x->m_model->set_precision(arg->s_name))
+    return;
+  if (x->m_model->is_loaded())
+    nn_tilde_reload(x);
+}
+// device [cpu | cuda | cuda:<index> | mps | gpu | auto], THE MODEL MOVES
+// RIGHT AWAY. WITHOUT ARGUMENT, PRINTS THE DEVICE IN USE
+void nn_tilde_device(t_nn_tilde *x, t_symbol *arg) {
+  if (arg == &s_) {
+    std::string message = "device: " + x->m_model->get_device();
+    post(message.c_str());
+    return;
+  }
+  x->m_model->set_device(arg->s_name);
+}
+void nn_tilde_cache(t_nn_tilde *x, t_floatarg arg) {
+  // ON-DISK CACHE OF THE OPTIMIZED MODELS, AFFECTS EVERY nn~ OBJECT
+  Backend::use_model_cache(int(arg));
+}
+void nn_tilde_profiling(t_nn_tilde *x, t_floatarg arg) {
+  // PROCESS-WIDE, AFFECTS EVERY nn~ OBJECT
+  Backend::use_profiling_executor(int(arg));
+}
+void nn_tilde_threads(t_nn_tilde *x, t_floatarg arg) {
+  // INTRA-OP THREADS USED INSIDE EACH MODEL CALL, 0 FOR THE GLOBAL BUDGET
+  x->m_model->set_intra_op_threads(int(arg));
+}
+// torch_threads [intra-op [inter-op]], FOR THE WHOLE PROCESS
+void nn_tilde_torch_threads(t_nn_tilde *x, t_symbol *s, int argc,
+                            t_atom *argv) {
+  if (!argc) {
+    auto budget = Backend::get_thread_budget();
+    std::string message = "torch threads: ";
+    message += std::to_string(budget[0]) + " intra-op, ";
+    message += std::to_string(budget[1]) + " inter-op";
+    post(message.c_str());
+    return;
+  }
+  Backend::set_thread_budget(atom_getint(argv),
+                             argc > 1 ? atom_getint(argv + 1) : 0);
+}
+// stats [reset]
+void nn_tilde_stats(t_nn_tilde *x, t_symbol *s, int argc, t_atom *argv) {
+  if (argc && atom_getsymbol(argv) == gensym("reset")) {
+    x->m_model->get_stats().reset();
+    return;
+  }
+  for (const auto &line : x->m_model->get_stats().format())
+    post(line.c_str());
+}
+void nn_tilde_stats_interval(t_nn_tilde *x, t_floatarg arg) {
+  // PERIOD IN MS, 0 TO DISABLE
+  x->m_stats_interval = std::max(int(arg), 0);
+  if (x->m_stats_interval > 0)
+    clock_delay(x->m_stats_clock, x->m_stats_interval);
+  else
+    clock_unset(x->m_stats_clock);
+}
+// render source destination [chunk_size [n_batches]], ARRAYS ARE MONO: THE
+// SOURCE FEEDS THE FIRST MODEL INPUT, THE FIRST OUTPUT IS WRITTEN
+void nn_tilde_render(t_nn_tilde *x, t_symbol *s, int argc, t_atom *argv) {
+  if (argc < 2 || !x->m_model->is_loaded() || !x->m_info_outlet) {
+    post("render needs a source and a destination array");
+    return;
+  }
+  auto array = (t_garray *)pd_findbyclass(atom_getsymbol(argv), garray_class);
+  int n_frames;
+  t_word *vec;
+  if (!array || !garray_getfloatwords(array, &n_frames, &vec)) {
+    post("nn~: source array not found");
+    return;
+  }
+  std::vector<std::vector<float>> inputs(1, std::vector<float>(n_frames));
+  for (int i(0); i < n_frames; i++)
+    inputs[0][i] = vec[i].w_float;
+
+  x->m_render_destination = atom_getsymbol(argv + 1);
+  if (x->m_renderer->start(*x->m_model, x->m_method->s_name,
+                           std::move(inputs),
+                           argc > 2 ? atom_getint(argv + 2) : 65536,
+                           argc > 3 ? atom_getint(argv + 3) : 1,
+                           x->m_interpolate, x->m_average))
+    return;
+  clock_delay(x->m_render_clock, 100);
+}
+void nn_tilde_cancel_render(t_nn_tilde *x) { x->m_renderer->cancel(); }
+
+// pool [threads [priority [core ...]]]
+void nn_tilde_pool(t_nn_tilde *x, t_symbol *s, int argc, t_atom *argv) {
+  if (!argc) {
+    std::string message = "compute pool: ";
+    message += std::to_string(ComputePool::get().get_num_threads());
+    message += " threads";
+    post(message.c_str());
+    return;
+  }
+  std::vector<int> affinity;
+  for (int i(2); i < argc; i++)
+    affinity.push_back(atom_getint(argv + i));
+  ComputePool::get().configure(atom_getint(argv),
+                               argc > 1 ? atom_getint(argv + 1) : 0, affinity);
+}
 
 void nn_tilde_set(t_nn_tilde *x, t_symbol *s, int argc, t_atom *argv) {
   if (argc < 2) {
@@ -256,7 +701,17 @@ void nn_tilde_set(t_nn_tilde *x, t_symbol *s, int argc, t_atom *argv) {
     }
   }
   try {
-    x->m_model->set_attribute(argname, attribute_args);
+    // A SINGLE NUMBER TAKES THE TYPED PATH, WITHOUT ANY STRING
+    auto float_id = x->m_model->get_float_attribute_id(argname_str);
+    if (float_id >= 0 && argc == 2 && argv[1].a_type == A_FLOAT)
+      x->m_model->set_float_attribute(float_id, atom_getfloat(argv + 1));
+    else
+      x->m_model->set_attribute(argname, attribute_args);
+    // APPLIED BETWEEN TWO BUFFERS, EVEN WHEN THE DSP IS OFF
+    auto model = x->m_model.get();
+    x->m_compute_strand->submit([model] { model->apply_attribute_commands(); });
+  } catch (std::string message) {
+    post(message.c_str());
   } catch (const std::exception &e) {
     post(e.what());
   }
@@ -288,6 +743,42 @@ void nn_tilde_setup(void) {
                   A_DEFFLOAT, A_NULL);
   class_addmethod(nn_tilde_class, (t_method)nn_tilde_reload, gensym("reload"),
                   A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_interpolate,
+                  gensym("interpolate"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_average,
+                  gensym("average"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_batching,
+                  gensym("batching"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_pipeline,
+                  gensym("pipeline"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_block_size,
+                  gensym("block_size"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_warmup, gensym("warmup"),
+                  A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_optimize,
+                  gensym("optimize"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_cache, gensym("cache"),
+                  A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_precision,
+                  gensym("precision"), A_DEFSYMBOL, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_device, gensym("device"),
+                  A_DEFSYMBOL, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_profiling,
+                  gensym("profiling"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_threads,
+                  gensym("threads"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_torch_threads,
+                  gensym("torch_threads"), A_GIMME, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_stats, gensym("stats"),
+                  A_GIMME, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_stats_interval,
+                  gensym("stats_interval"), A_DEFFLOAT, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_render, gensym("render"),
+                  A_GIMME, A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_cancel_render,
+                  gensym("cancel_render"), A_NULL);
+  class_addmethod(nn_tilde_class, (t_method)nn_tilde_pool, gensym("pool"),
+                  A_GIMME, A_NULL);
   class_addmethod(nn_tilde_class, (t_method)nn_tilde_set, gensym("set"),
                   A_GIMME, A_NULL);
   CLASS_MAINSIGNALIN(nn_tilde_class, t_nn_tilde, f);